@@ -13,9 +13,37 @@ static char doc[] = "neodymium -- terminal text editor for linux";
 
 static char args_doc[] = "[FILES...]";
 
+#define BENCH_LINES 1000000
+#define BENCH_TABS 100
+#define BENCH_TAB_LINES 10000
+#define BENCH_KEYS 5000
+#define BENCH_PAGES 2000
+#define BENCH_SAVES 5
+#define REPLAY_SLOWEST 5
+
 struct arguments {
 	char** files;
 	int num;
+	const frameBackend* backend;
+	bool stats;
+	bool bench;
+	char* record;
+	char* replay;
+	int budget;
+	bool noSync;
+	long undoLimit;
+};
+
+static struct argp_option options[] = {
+	{ "backend", 'b', "NAME", 0, "Draw the screen with NAME (curses or vt100)", 0 },
+	{ "stats", 's', 0, 0, "Print how much was written to the terminal on exit", 0 },
+	{ "bench", 'B', 0, 0, "Run the benchmark workloads headless and print latencies", 0 },
+	{ "budget", 'l', "MS", 0, "Draw at least every MS milliseconds while handling a burst of keys like a paste", 0 },
+	{ "no-sync", 'n', 0, 0, "Don't wait for saved files to reach the disk", 0 },
+	{ "undo-limit", 'u', "MB", 0, "Keep at most MB megabytes of undo history for each file", 0 },
+	{ "record", 'r', "FILE", 0, "Log every key pressed to FILE, with timestamps", 0 },
+	{ "replay", 'p', "FILE", 0, "Feed the keys logged in FILE through the editor headless, as fast as possible, and print latencies (saves are replayed too)", 0 },
+	{ 0 }
 };
 
 static error_t parse_opt(int key, char* arg, struct argp_state* state) {
@@ -36,6 +64,41 @@ static error_t parse_opt(int key, char* arg, struct argp_state* state) {
 			}
 			arguments->files[arguments->num - 1] = strdup(arg);
 		} break;
+		case 'b': {
+			arguments->backend = frameBackendFind(arg);
+			if (!arguments->backend) {
+				argp_error(state, "unknown backend '%s'", arg);
+			}
+		} break;
+		case 's': {
+			arguments->stats = true;
+		} break;
+		case 'B': {
+			arguments->bench = true;
+		} break;
+		case 'l': {
+			char* end = NULL;
+			arguments->budget = strtol(arg, &end, 10);
+			if (!end || *end != '\0' || arguments->budget <= 0) {
+				argp_error(state, "invalid budget '%s'", arg);
+			}
+		} break;
+		case 'n': {
+			arguments->noSync = true;
+		} break;
+		case 'u': {
+			char* end = NULL;
+			arguments->undoLimit = strtol(arg, &end, 10);
+			if (!end || *end != '\0' || arguments->undoLimit <= 0) {
+				argp_error(state, "invalid undo limit '%s'", arg);
+			}
+		} break;
+		case 'r': {
+			arguments->record = arg;
+		} break;
+		case 'p': {
+			arguments->replay = arg;
+		} break;
 		default: {
 			return ARGP_ERR_UNKNOWN;
 		} break;
@@ -43,12 +106,291 @@ static error_t parse_opt(int key, char* arg, struct argp_state* state) {
 	return 0;
 }
 
-static struct argp argp = { 0, parse_opt, args_doc, doc };
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+/// @brief Latency samples (in microseconds) for one benchmarked operation.
+typedef struct {
+	const char* name;
+	double* samples;
+	int num, max;
+} benchOp;
+
+static double benchNow() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1e6) + (ts.tv_nsec / 1e3);
+}
+
+static void benchAdd(benchOp* op, double us) {
+	if (op->num >= op->max) {
+		int newMax = (op->max == 0) ? 64 : (op->max * 2);
+		double* newSamples = realloc(op->samples, newMax * sizeof(*newSamples));
+		if (!newSamples) { return; }
+		op->samples = newSamples;
+		op->max = newMax;
+	}
+	op->samples[op->num++] = us;
+}
+
+static void benchKey(editorContext* ctx, benchOp* op, int key) {
+	// Time a key the way the event loop handles it, from input to the next frame
+	double start = benchNow();
+	editorHandleInput(ctx, key);
+	if (editorGetState(ctx) != ES_SHOULD_CLOSE) {
+		editorUpdate(ctx);
+		editorPrint(ctx);
+	}
+	benchAdd(op, benchNow() - start);
+}
+
+static int benchCompare(const void* a, const void* b) {
+	double x = *(const double*)(a);
+	double y = *(const double*)(b);
+	return (x > y) - (x < y);
+}
+
+static void benchFormat(char* buf, size_t len, double us) {
+	if (us < 1e3) {
+		snprintf(buf, len, "%.1fus", us);
+	} else if (us < 1e6) {
+		snprintf(buf, len, "%.2fms", us / 1e3);
+	} else {
+		snprintf(buf, len, "%.2fs", us / 1e6);
+	}
+}
+
+static void benchReport(benchOp* op) {
+	if (op->num == 0) { return; }
+
+	// Percentiles are taken by nearest rank
+	qsort(op->samples, op->num, sizeof(*op->samples), benchCompare);
+	double total = 0;
+	for(int i=0; i<op->num; ++i) {
+		total += op->samples[i];
+	}
+	double values[5] = {
+		total / op->num,
+		op->samples[(op->num * 50 + 99) / 100 - 1],
+		op->samples[(op->num * 90 + 99) / 100 - 1],
+		op->samples[(op->num * 99 + 99) / 100 - 1],
+		op->samples[op->num - 1]
+	};
+	printf("%-12s %8d", op->name, op->num);
+	for(int i=0; i<5; ++i) {
+		char buf[16];
+		benchFormat(buf, sizeof(buf), values[i]);
+		printf(" %10s", buf);
+	}
+	printf("\n");
+	free(op->samples);
+}
+
+static bool benchWriteFile(const char* path, int lines) {
+	FILE* fp = fopen(path, "w");
+	if (!fp) { return false; }
+	for(int i=0; i<lines; ++i) {
+		fprintf(fp, "%07d\tthe quick brown fox jumps over the lazy dog\n", i);
+	}
+	return fclose(fp) == 0;
+}
+
+static void openFiles(editorContext* ctx, struct arguments* arguments) {
+	if (arguments->num == 0) {
+		// Open a blank untitled page
+		editorOpenPage(ctx, NULL, -1);
+	} else {
+		// Read the files on worker threads, in tab order. Files that can't be
+		// opened are left as blank pages with the files name
+		for(int i = 0; i < arguments->num; ++i) {
+			if (!editorLoadPage(ctx, arguments->files[i])) {
+				editorOpenPage(ctx, NULL, -1);
+				pageSetFullFilename(EDITOR_CURR_PAGE(ctx), arguments->files[i]);
+			}
+			free(arguments->files[i]);
+		}
+
+		// Only the page that's shown first has to be ready before drawing
+		editorPage* page = EDITOR_CURR_PAGE(ctx);
+		if (page->job) {
+			workerPoolPromote(&ctx->workers, page->job);
+			editorWaitPage(ctx, page);
+		}
+	}
+	free(arguments->files);
+}
+
+static int replayRun(struct arguments* arguments) {
+	editorContext ctx;
+	editorInit(&ctx);
+	ctx.settingSaveSync = !arguments->noSync;
+	if (arguments->undoLimit > 0) {
+		ctx.settingUndoLimit = (size_t)(arguments->undoLimit) * 1024 * 1024;
+	}
+	int rows = 0, cols = 0;
+	if (!editorLoadKeys(&ctx, arguments->replay, &rows, &cols)) {
+		fprintf(stderr, "Failed to read key log (%s)!\n", arguments->replay);
+		editorClear(&ctx);
+		return 1;
+	}
+
+	// Draw at the size the keys were recorded at, since it changes what keys like Page Down do
+	if (rows > 0 && cols > 0) {
+		char buf[16];
+		snprintf(buf, sizeof(buf), "%d", rows);
+		setenv("LINES", buf, 1);
+		snprintf(buf, sizeof(buf), "%d", cols);
+		setenv("COLUMNS", buf, 1);
+	}
+	editorSetBackend(&ctx, frameBackendFind("headless"));
+	int numKeys = ctx.input.size;
+	openFiles(&ctx, arguments);
+
+	// The keys were pressed on loaded pages, so wait for all of them
+	editorWaitJobs(&ctx);
+	editorUpdate(&ctx);
+	editorPrint(&ctx);
+
+	// Keys read by prompts are counted towards the key that opened the prompt
+	benchOp keys = { "key" };
+	struct { int index, key; double us; } slowest[REPLAY_SLOWEST] = { 0 };
+	double start = benchNow();
+	for(int i=0; editorGetState(&ctx) != ES_SHOULD_CLOSE; ++i) {
+		int key = editorReadKey(&ctx, -1);
+		if (key == ERR) { break; }
+		benchKey(&ctx, &keys, key);
+
+		// Keep the slowest keys in order
+		double us = keys.samples[keys.num - 1];
+		for(int j=0; j<REPLAY_SLOWEST; ++j) {
+			if (us <= slowest[j].us) { continue; }
+			memmove(&slowest[j + 1], &slowest[j], (REPLAY_SLOWEST - j - 1) * sizeof(*slowest));
+			slowest[j].index = i;
+			slowest[j].key = key;
+			slowest[j].us = us;
+			break;
+		}
+	}
+	double total = benchNow() - start;
+	editorClear(&ctx);
+
+	char buf[16];
+	benchFormat(buf, sizeof(buf), total);
+	printf("replayed %d keys in %s\n", numKeys, buf);
+	printf("%-12s %8s %10s %10s %10s %10s %10s\n", "operation", "count", "mean", "p50", "p90", "p99", "max");
+	benchReport(&keys);
+	printf("slowest keys:\n");
+	for(int i=0; i<REPLAY_SLOWEST && slowest[i].us > 0; ++i) {
+		const char* name = keyname(slowest[i].key);
+		benchFormat(buf, sizeof(buf), slowest[i].us);
+		printf("  #%-8d %-12s %10s\n", slowest[i].index + 1, name ? name : "?", buf);
+	}
+	return status_code;
+}
+
+static int benchRun() {
+	// Generate files to work on
+	char dir[] = "/tmp/neo-bench-XXXXXX";
+	if (!mkdtemp(dir)) {
+		fprintf(stderr, "Failed to create a directory for the benchmark!\n");
+		return 1;
+	}
+	char bigFile[64];
+	snprintf(bigFile, sizeof(bigFile), "%s/big.txt", dir);
+	bool written = benchWriteFile(bigFile, BENCH_LINES);
+	for(int i=0; i<BENCH_TABS && written; ++i) {
+		char tabFile[64];
+		snprintf(tabFile, sizeof(tabFile), "%s/tab%03d.txt", dir, i);
+		written = benchWriteFile(tabFile, BENCH_TAB_LINES);
+	}
+
+	editorContext ctx;
+	editorInit(&ctx);
+	editorSetBackend(&ctx, frameBackendFind("headless"));
+	benchOp load = { "load" };
+	benchOp type = { "type" };
+	benchOp page = { "page" };
+	benchOp open = { "open tab" };
+	benchOp tab = { "switch tab" };
+	benchOp save = { "save" };
+	benchOp saved = { "save (disk)" };
+	if (written) {
+		// Load the big file
+		double start = benchNow();
+		editorOpenPage(&ctx, bigFile, -1);
+		editorUpdate(&ctx);
+		editorPrint(&ctx);
+		benchAdd(&load, benchNow() - start);
+
+		// Type into the middle of it
+		char line[32];
+		snprintf(line, sizeof(line), "%d\r", BENCH_LINES / 2);
+		keyQueuePushStr(&ctx.input, line);
+		editorHandleInput(&ctx, CTRL_KEY('g'));
+		const char* text = "the quick brown fox jumps over the lazy dog ";
+		for(int i=0; i<BENCH_KEYS; ++i) {
+			benchKey(&ctx, &type, (i % 64 == 63) ? '\r' : text[i % strlen(text)]);
+		}
+
+		// Page through it from the top
+		benchKey(&ctx, &page, NEO_KEY_CTRL_HOME);
+		for(int i=0; i<BENCH_PAGES; ++i) {
+			benchKey(&ctx, &page, KEY_NPAGE);
+		}
+		for(int i=0; i<BENCH_PAGES; ++i) {
+			benchKey(&ctx, &page, KEY_PPAGE);
+		}
+
+		// Open a tab for every small file, then cycle through them
+		for(int i=0; i<BENCH_TABS; ++i) {
+			char tabFile[64];
+			snprintf(tabFile, sizeof(tabFile), "%s/tab%03d.txt", dir, i);
+			start = benchNow();
+			editorOpenPage(&ctx, tabFile, -1);
+			editorUpdate(&ctx);
+			editorPrint(&ctx);
+			benchAdd(&open, benchNow() - start);
+		}
+		for(int i=0; i<=BENCH_TABS; ++i) {
+			benchKey(&ctx, &tab, CTRL_KEY('t'));
+		}
 
-void eventLoop(editorContext* ctx) {
-	editorUpdate(ctx);
-	editorPrint(ctx);
-	refresh();
+		// Save the big file, splitting a line first so there's something to save.
+		// The key only starts the save, so also time until it's on disk
+		editorSetPage(&ctx, 0);
+		for(int i=0; i<BENCH_SAVES; ++i) {
+			editorHandleInput(&ctx, '\r');
+			double start = benchNow();
+			benchKey(&ctx, &save, CTRL_KEY('s'));
+			editorWaitJobs(&ctx);
+			benchAdd(&saved, benchNow() - start);
+		}
+	} else {
+		fprintf(stderr, "Failed to write files for the benchmark!\n");
+	}
+	editorClear(&ctx);
+
+	// Clean up the files, along with the undo history kept for the saved one
+	char journal[64];
+	snprintf(journal, sizeof(journal), "%s/.big.txt.undo", dir);
+	unlink(bigFile);
+	unlink(journal);
+	for(int i=0; i<BENCH_TABS; ++i) {
+		char tabFile[64];
+		snprintf(tabFile, sizeof(tabFile), "%s/tab%03d.txt", dir, i);
+		unlink(tabFile);
+	}
+	rmdir(dir);
+	if (!written) { return 1; }
+
+	printf("%-12s %8s %10s %10s %10s %10s %10s\n", "operation", "count", "mean", "p50", "p90", "p99", "max");
+	benchReport(&load);
+	benchReport(&type);
+	benchReport(&page);
+	benchReport(&open);
+	benchReport(&tab);
+	benchReport(&save);
+	benchReport(&saved);
+	return status_code;
 }
 
 int main(int argc, char* argv[]) {
@@ -57,49 +399,64 @@ int main(int argc, char* argv[]) {
 	if (argp_parse(&argp, argc, argv, 0, 0, &arguments) != 0) {
 		return 1;
 	}
-
-	// Register signal handlers
-	struct sigaction sa;
-	sa.sa_handler = signalHandler;
-	sigemptyset(&sa.sa_mask);
-	if (sigaction(SIGWINCH, &sa, NULL) == -1) { 
-		return 1; 
+	if (arguments.bench) {
+		return benchRun();
+	}
+	if (arguments.replay) {
+		return replayRun(&arguments);
 	}
 
-	// Initialize ncurses
-	cursesInit();
+	// Initialize ncurses, unless there's no terminal to draw to
+	const frameBackend* backend = arguments.backend ? arguments.backend : frameBackendFind(NULL);
+	if (backend->terminal) {
+		cursesInit();
+	}
 
 	// Create editor context
 	editorContext ctx;
 	editorInit(&ctx);
+	editorSetBackend(&ctx, backend);
+	ctx.frame.stats = arguments.stats;
+	if (arguments.budget > 0) {
+		ctx.settingInputBudget = arguments.budget;
+	}
+	ctx.settingSaveSync = !arguments.noSync;
+	if (arguments.undoLimit > 0) {
+		ctx.settingUndoLimit = (size_t)(arguments.undoLimit) * 1024 * 1024;
+	}
+
+	// Signals have to be blocked before any loading threads are started
+	if (backend->terminal && !editorWatchTerminal(&ctx)) {
+		editorSetMessage(&ctx, "Failed to watch the terminal, resizing won't be noticed!");
+	}
 
 	// Load files from command line
-	if (arguments.num == 0) {
-		// Open a blank untitled page
-		editorOpenPage(&ctx, NULL, -1);
-	} else {
-		for(int i = 0; i < arguments.num; ++i) {
-			if (!editorOpenPage(&ctx, arguments.files[i], -1)) {
-				// If opening the file failed, create a blank page with the files name
-				editorSetMessage(&ctx, "");
-				editorOpenPage(&ctx, NULL, -1);
-				pageSetFullFilename(EDITOR_CURR_PAGE(&ctx), arguments.files[i]);
-			}
-			free(arguments.files[i]);
-		}
+	openFiles(&ctx, &arguments);
+	if (arguments.record && !editorRecordKeys(&ctx, arguments.record)) {
+		editorSetMessage(&ctx, "Failed to record keys (%s)!", arguments.record);
 	}
-	free(arguments.files);
 
 	// Event loop
 	while(editorGetState(&ctx) != ES_SHOULD_CLOSE) {
 		editorUpdate(&ctx);
 		editorPrint(&ctx);
-		refresh();
 		if (editorGetState(&ctx) != ES_SHOULD_CLOSE) {
-			editorHandleInput(&ctx, getch());
+			// Anything other than a key means the screen needs redrawing
+			int key = editorReadKey(&ctx, -1);
+			if (key != ERR) {
+				editorHandleKeys(&ctx, key);
+			} else if (!backend->terminal) {
+				// Headless runs end once there's no input left
+				editorAbort(&ctx, 0);
+			}
 		}
 	}
-	endwin();
+	if (backend->terminal) {
+		cursesEnd();
+	}
+	if (arguments.stats) {
+		framePrintStats(&ctx.frame, stderr);
+	}
 
 	editorClear(&ctx);
 	return status_code;
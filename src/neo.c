@@ -1,22 +1,40 @@
 #include "neo.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+	#include <immintrin.h>
+	#define NEO_X86
+#endif
+
 void cursesInit() {
 	initscr();
+	idlok(stdscr, true);
 	noecho();
 	cbreak();
 	raw();
 	keypad(stdscr, true);
+	define_key("\x1b[1;5H", NEO_KEY_CTRL_HOME);
+	define_key("\x1b[1;5F", NEO_KEY_CTRL_END);
+
+	// Have the terminal bracket pasted text, so it can be inserted in one go
+	define_key("\x1b[200~", NEO_KEY_PASTE_START);
+	define_key("\x1b[201~", NEO_KEY_PASTE_END);
+	printf("\x1b[?2004h");
+	fflush(stdout);
 }
 
-void signalHandler(int sig) {
-	switch(sig) {
-		case SIGWINCH: {
-			_neo_flag_resized = true; 
-			endwin();
-			refresh();
-			clear();
-		} break;
-	}
+void cursesEnd() {
+	endwin();
+	printf("\x1b[?2004l");
+	fflush(stdout);
+}
+
+void cursesResize() {
+	struct winsize ws;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_row == 0 || ws.ws_col == 0) { return; }
+
+	// Whatever was on the terminal has been reflowed, so redraw all of it
+	resizeterm(ws.ws_row, ws.ws_col);
+	clear();
 }
 
 void menuGroupInit(menuGroup* grp) {
@@ -77,7 +95,815 @@ void menuGroupDelete(menuGroup* grp, int at) {
 	if (grp->selected == at) { grp->selected = 0; }
 }
 
-bool _neo_flag_resized = false;
+void frameInit(editorFrame* frame) {
+	if (!frame) { return; }
+
+	memset(frame, 0, sizeof(*frame));
+	frame->backend = frameBackendFind(NULL);
+	frame->full = true;
+}
+
+void frameClear(editorFrame* frame) {
+	if (!frame) { return; }
+
+	if (frame->backend && frame->backend->release) {
+		frame->backend->release(frame);
+	}
+	free(frame->cells);
+	free(frame->hashes);
+	frameInit(frame);
+}
+
+void frameBegin(editorFrame* frame, int rows, int cols) {
+	if (!frame) { return; }
+
+	// Reallocate the grid when the screen changes size
+	rows = MAX(rows, 0);
+	cols = MAX(cols, 0);
+	if (rows != frame->rows || cols != frame->cols) {
+		chtype* newCells = realloc(frame->cells, MAX(1, rows * cols) * sizeof(*newCells));
+		uint64_t* newHashes = realloc(frame->hashes, MAX(1, rows) * sizeof(*newHashes));
+		if (newCells) { frame->cells = newCells; }
+		if (newHashes) { frame->hashes = newHashes; }
+		if (!newCells || !newHashes) { rows = cols = 0; }
+		frame->rows = rows;
+		frame->cols = cols;
+		frame->full = true;
+	}
+
+	// Start from a blank screen
+	for(int i=0; i<rows * cols; ++i) {
+		frame->cells[i] = ' ';
+	}
+	frame->y = 0;
+	frame->x = 0;
+	frame->attr = A_NORMAL;
+}
+
+void frameMove(editorFrame* frame, int y, int x) {
+	if (!frame) { return; }
+
+	frame->y = y;
+	frame->x = x;
+}
+
+void frameAttrOn(editorFrame* frame, attr_t attr) {
+	if (!frame) { return; }
+	frame->attr |= attr;
+}
+
+void frameAttrOff(editorFrame* frame, attr_t attr) {
+	if (!frame) { return; }
+	frame->attr &= ~attr;
+}
+
+void frameAddChar(editorFrame* frame, int c) {
+	if (!frame) { return; }
+
+	// Spell out unprintable characters instead of sending them to the terminal
+	c = (unsigned char)(c);
+	if (!isprint(c)) {
+		const char* str = unctrl(c);
+		for(int i=0; str && str[i]; ++i) {
+			frameFill(frame, str[i], 1);
+		}
+		return;
+	}
+	frameFill(frame, c, 1);
+}
+
+void frameAddStr(editorFrame* frame, const char* str, int len) {
+	if (!frame || !str) { return; }
+
+	for(int i=0; (len < 0 || i < len) && str[i]; ++i) {
+		frameAddChar(frame, str[i]);
+	}
+}
+
+void frameFill(editorFrame* frame, int c, int num) {
+	if (!frame) { return; }
+
+	if (frame->y >= 0 && frame->y < frame->rows) {
+		chtype* line = &frame->cells[frame->y * frame->cols];
+		for(int i=0; i<num; ++i) {
+			int x = frame->x + i;
+			if (x >= 0 && x < frame->cols) {
+				line[x] = (chtype)(unsigned char)(c) | frame->attr;
+			}
+		}
+	}
+	frame->x += MAX(num, 0);
+}
+
+void frameSetCursor(editorFrame* frame, int y, int x, bool visible) {
+	if (!frame) { return; }
+
+	frame->cursorY = y;
+	frame->cursorX = x;
+	frame->cursorVisible = visible;
+}
+
+static void frameTerminalSize(editorFrame* frame, int* rows, int* cols) {
+	(void)(frame);
+	getmaxyx(stdscr, *rows, *cols);
+}
+
+static void frameCursesLine(editorFrame* frame, int y, const chtype* cells) {
+	// Send the line in one go, clearing the blank space at the end
+	int len = frame->cols;
+	while(len > 0 && cells[len - 1] == ' ') {
+		len--;
+	}
+	mvaddchnstr(y, 0, cells, len);
+	if (len < frame->cols) {
+		move(y, len);
+		clrtoeol();
+	}
+}
+
+static void frameCursesScroll(editorFrame* frame, int top, int bottom, int num) {
+	setscrreg(top, bottom);
+	scrollok(stdscr, true);
+	scrl(num);
+	scrollok(stdscr, false);
+	setscrreg(0, frame->rows - 1);
+}
+
+static uint64_t frameBytesWritten() {
+	// Curses writes straight to the terminal's descriptor rather than through
+	// its stream, so the kernel does the counting. Only this thread's writes
+	// are counted, leaving out saves and swap files written in the meantime
+	uint64_t bytes = 0;
+	FILE* fp = fopen("/proc/thread-self/io", "r");
+	if (fp) {
+		char line[64];
+		while(fgets(line, sizeof(line), fp)) {
+			if (sscanf(line, "wchar: %" SCNu64, &bytes) == 1) { break; }
+		}
+		fclose(fp);
+	}
+	return bytes;
+}
+
+static int64_t frameCursesEnd(editorFrame* frame) {
+	curs_set(frame->cursorVisible ? 1 : 0);
+	if (frame->cursorVisible) {
+		move(frame->cursorY, frame->cursorX);
+	}
+
+	// Send the frame to the terminal, keeping track of how much was written
+	if (!frame->stats) {
+		refresh();
+		return 0;
+	}
+	uint64_t bytes = frameBytesWritten();
+	refresh();
+	return frameBytesWritten() - bytes;
+}
+
+static const frameBackend frameBackendCurses = {
+	.name = "curses",
+	.terminal = true,
+	.getSize = frameTerminalSize,
+	.line = frameCursesLine,
+	.scrollRegion = frameCursesScroll,
+	.end = frameCursesEnd
+};
+
+/// @brief Cells on the terminal as of the last frame, and the output for the
+/// @brief next one. The cursor position and attributes are tracked so escape
+/// @brief sequences are only sent when they change (-1 when unknown).
+typedef struct {
+	chtype* front;
+	int rows, cols;
+	strbuf out;
+	int cursorY, cursorX;
+	int cursorVisible;
+	attr_t attr;
+} frameVT100;
+
+static void frameVT100Printf(frameVT100* vt, const char* fmt, ...) {
+	char buf[32];
+	va_list args;
+	va_start(args, fmt);
+	int len = vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	if (len > 0) { strbufAppend(&vt->out, buf, MIN(len, (int)(sizeof(buf) - 1))); }
+}
+
+static void frameVT100Move(frameVT100* vt, int y, int x) {
+	if (vt->cursorY == y && vt->cursorX == x) { return; }
+	frameVT100Printf(vt, "\x1b[%d;%dH", y + 1, x + 1);
+	vt->cursorY = y;
+	vt->cursorX = x;
+}
+
+static void frameVT100Attr(frameVT100* vt, attr_t attr) {
+	if (vt->attr == attr) { return; }
+	strbufAppend(&vt->out, "\x1b[0", 3);
+	if (attr & A_BOLD)      { strbufAppend(&vt->out, ";1", 2); }
+	if (attr & A_UNDERLINE) { strbufAppend(&vt->out, ";4", 2); }
+	if (attr & A_REVERSE)   { strbufAppend(&vt->out, ";7", 2); }
+	strbufAddChar(&vt->out, 'm');
+	vt->attr = attr;
+}
+
+static void frameVT100Begin(editorFrame* frame) {
+	frameVT100* vt = frame->backendData;
+	if (!vt) {
+		vt = calloc(1, sizeof(*vt));
+		if (!vt) { return; }
+		strbufInit(&vt->out, 4096);
+		frame->backendData = vt;
+
+		// Input still goes through ncurses, which must never draw over us
+		leaveok(stdscr, true);
+	}
+	vt->out.size = 0;
+	if (!frame->full) { return; }
+
+	// Let ncurses finish any redraw of its own (after a resize) before taking over
+	refresh();
+	if (vt->rows != frame->rows || vt->cols != frame->cols) {
+		chtype* newFront = realloc(vt->front, MAX(1, frame->rows * frame->cols) * sizeof(*newFront));
+		if (!newFront) { return; }
+		vt->front = newFront;
+		vt->rows = frame->rows;
+		vt->cols = frame->cols;
+	}
+	for(int i=0; i<vt->rows * vt->cols; ++i) {
+		vt->front[i] = ' ';
+	}
+	strbufAppend(&vt->out, "\x1b[0m\x1b[H\x1b[2J", 11);
+	vt->cursorY = vt->cursorX = 0;
+	vt->cursorVisible = -1;
+	vt->attr = A_NORMAL;
+}
+
+static void frameVT100Scroll(editorFrame* frame, int top, int bottom, int num) {
+	frameVT100* vt = frame->backendData;
+	if (!vt || vt->rows != frame->rows || vt->cols != frame->cols) { return; }
+
+	// Lines scrolled in are blanked with the current background, so reset it first
+	frameVT100Attr(vt, A_NORMAL);
+	frameVT100Printf(vt, "\x1b[%d;%dr", top + 1, bottom + 1);
+	vt->cursorY = vt->cursorX = -1;
+	if (num > 0) {
+		frameVT100Move(vt, bottom, 0);
+		for(int i=0; i<num; ++i) { strbufAddChar(&vt->out, '\n'); }
+	} else {
+		frameVT100Move(vt, top, 0);
+		for(int i=0; i<-num; ++i) { strbufAppend(&vt->out, "\x1bM", 2); }
+	}
+	strbufAppend(&vt->out, "\x1b[r", 3);
+	vt->cursorY = vt->cursorX = 0;
+
+	// Move the front cells along with the screen
+	int cols = vt->cols;
+	int n = abs(num);
+	int moved = (bottom - top + 1) - n;
+	chtype* region = &vt->front[top * cols];
+	if (num > 0) {
+		memmove(region, &region[n * cols], moved * cols * sizeof(*region));
+		region = &region[moved * cols];
+	} else {
+		memmove(&region[n * cols], region, moved * cols * sizeof(*region));
+	}
+	for(int i=0; i<n * cols; ++i) {
+		region[i] = ' ';
+	}
+}
+
+static void frameVT100Line(editorFrame* frame, int y, const chtype* cells) {
+	frameVT100* vt = frame->backendData;
+	if (!vt || vt->rows != frame->rows || vt->cols != frame->cols) { return; }
+
+	// Find the span of cells that changed
+	chtype* front = &vt->front[y * vt->cols];
+	int first = 0;
+	int last = vt->cols - 1;
+	while(first <= last && front[first] == cells[first]) { first++; }
+	if (first > last) { return; }
+	while(front[last] == cells[last]) { last--; }
+
+	// Blank space at the end of the line is erased rather than drawn
+	int len = vt->cols;
+	while(len > 0 && cells[len - 1] == ' ') { len--; }
+	bool erase = (last >= len);
+	int end = erase ? len : (last + 1);
+
+	for(int x=first; x<end; ++x) {
+		// Jump over runs of cells already on screen when moving is shorter
+		int same = x;
+		while(same < end && front[same] == cells[same]) { same++; }
+		if (same - x > 8) {
+			x = same - 1;
+			continue;
+		}
+		frameVT100Move(vt, y, x);
+		frameVT100Attr(vt, cells[x] & A_ATTRIBUTES);
+		strbufAddChar(&vt->out, (char)(cells[x] & A_CHARTEXT));
+		vt->cursorX++;
+	}
+	if (erase) {
+		frameVT100Move(vt, y, end);
+		frameVT100Attr(vt, A_NORMAL);
+		strbufAppend(&vt->out, "\x1b[K", 3);
+	}
+
+	// The cursor is left hanging after writing the last column, so stop tracking it
+	if (vt->cursorX >= vt->cols) { vt->cursorY = vt->cursorX = -1; }
+	memcpy(front, cells, vt->cols * sizeof(*front));
+}
+
+static int64_t frameVT100End(editorFrame* frame) {
+	frameVT100* vt = frame->backendData;
+	if (!vt) { return 0; }
+
+	if (frame->cursorVisible) {
+		frameVT100Move(vt, frame->cursorY, frame->cursorX);
+	}
+	if (vt->cursorVisible != frame->cursorVisible) {
+		strbufAppend(&vt->out, frame->cursorVisible ? "\x1b[?25h" : "\x1b[?25l", 6);
+		vt->cursorVisible = frame->cursorVisible;
+	}
+
+	// Send the whole frame with a single write
+	size_t sent = 0;
+	while(sent < vt->out.size) {
+		ssize_t len = write(STDOUT_FILENO, &vt->out.data[sent], vt->out.size - sent);
+		if (len < 0) {
+			if (errno == EINTR) { continue; }
+			break;
+		}
+		sent += len;
+	}
+	vt->out.size = 0;
+	return sent;
+}
+
+static void frameVT100Release(editorFrame* frame) {
+	frameVT100* vt = frame->backendData;
+	if (!vt) { return; }
+
+	// Leave the cursor showing for the shell
+	if (vt->cursorVisible != 1) {
+		ssize_t len = write(STDOUT_FILENO, "\x1b[?25h", 6);
+		(void)(len);
+	}
+	free(vt->front);
+	strbufClear(&vt->out);
+	free(vt);
+	frame->backendData = NULL;
+}
+
+static const frameBackend frameBackendVT100 = {
+	.name = "vt100",
+	.terminal = true,
+	.getSize = frameTerminalSize,
+	.begin = frameVT100Begin,
+	.line = frameVT100Line,
+	.scrollRegion = frameVT100Scroll,
+	.end = frameVT100End,
+	.release = frameVT100Release
+};
+
+static void frameHeadlessSize(editorFrame* frame, int* rows, int* cols) {
+	(void)(frame);
+
+	// Sized the same way ncurses would be without a terminal to ask
+	const char* lines = getenv("LINES");
+	const char* columns = getenv("COLUMNS");
+	*rows = (lines && atoi(lines) > 0) ? atoi(lines) : 24;
+	*cols = (columns && atoi(columns) > 0) ? atoi(columns) : 80;
+}
+
+static const frameBackend frameBackendHeadless = {
+	.name = "headless",
+	.terminal = false,
+	.getSize = frameHeadlessSize
+};
+
+const frameBackend* frameBackendFind(const char* name) {
+	static const frameBackend* backends[] = { &frameBackendCurses, &frameBackendVT100, &frameBackendHeadless };
+	if (!name) { return backends[0]; }
+
+	for(size_t i=0; i<sizeof(backends) / sizeof(*backends); ++i) {
+		if (strcmp(backends[i]->name, name) == 0) { return backends[i]; }
+	}
+	return NULL;
+}
+
+void frameSetBackend(editorFrame* frame, const frameBackend* backend) {
+	if (!frame || !backend) { return; }
+
+	if (frame->backend && frame->backend->release) {
+		frame->backend->release(frame);
+	}
+	frame->backend = backend;
+	frame->full = true;
+}
+
+void frameScroll(editorFrame* frame, int top, int bottom, int num) {
+	if (!frame) { return; }
+
+	// Scrolling a whole region away is no better than redrawing it
+	if (top < 0 || bottom >= frame->rows || top >= bottom || abs(num) > bottom - top) { return; }
+	frame->scrollTop = top;
+	frame->scrollBottom = bottom;
+	frame->scrollNum = num;
+}
+
+void frameFlush(editorFrame* frame) {
+	if (!frame || !frame->backend) { return; }
+	const frameBackend* backend = frame->backend;
+
+	if (backend->begin) {
+		backend->begin(frame);
+	}
+
+	// Scroll the screen, moving line hashes along with it so only the exposed lines are sent
+	bool scrolled = false;
+	if (frame->scrollNum != 0 && !frame->full) {
+		int top = frame->scrollTop;
+		int bottom = frame->scrollBottom;
+		int num = abs(frame->scrollNum);
+		int moved = (bottom - top + 1) - num;
+		if (backend->scrollRegion) {
+			backend->scrollRegion(frame, top, bottom, frame->scrollNum);
+		}
+		if (frame->scrollNum > 0) {
+			memmove(&frame->hashes[top], &frame->hashes[top + num], moved * sizeof(*frame->hashes));
+			memset(&frame->hashes[top + moved], 0, num * sizeof(*frame->hashes));
+		} else {
+			memmove(&frame->hashes[top + num], &frame->hashes[top], moved * sizeof(*frame->hashes));
+			memset(&frame->hashes[top], 0, num * sizeof(*frame->hashes));
+		}
+		scrolled = true;
+	}
+	frame->scrollNum = 0;
+
+	for(int y=0; y<frame->rows; ++y) {
+		// Skip lines that are the same as last frame
+		chtype* line = &frame->cells[y * frame->cols];
+		uint64_t hash = 14695981039346656037ULL;
+		for(int x=0; x<frame->cols; ++x) {
+			hash = (hash ^ line[x]) * 1099511628211ULL;
+		}
+		if (!frame->full && hash == frame->hashes[y]) { continue; }
+		frame->hashes[y] = hash;
+		if (backend->line) {
+			backend->line(frame, y, line);
+		}
+	}
+	frame->full = false;
+
+	int64_t bytes = backend->end ? backend->end(frame) : 0;
+	if (!frame->stats) { return; }
+	frame->numFrames++;
+	frame->numBytes += bytes;
+	if (scrolled) {
+		frame->numScrolls++;
+		frame->scrollBytes += bytes;
+	}
+}
+
+void framePrintStats(editorFrame* frame, FILE* fp) {
+	if (!frame || !fp) { return; }
+
+	fprintf(
+		fp, "frames: %" PRIu64 ", bytes: %" PRIu64 " (%.1f per frame)\n", 
+		frame->numFrames, frame->numBytes, 
+		frame->numFrames ? (double)frame->numBytes / frame->numFrames : 0.0
+	);
+	fprintf(
+		fp, "scroll steps: %" PRIu64 ", bytes: %" PRIu64 " (%.1f per step)\n", 
+		frame->numScrolls, frame->scrollBytes, 
+		frame->numScrolls ? (double)frame->scrollBytes / frame->numScrolls : 0.0
+	);
+}
+
+void keyQueueInit(keyQueue* queue) {
+	if (!queue) { return; }
+
+	queue->keys = NULL;
+	queue->head = 0;
+	queue->size = 0;
+	queue->capacity = 0;
+}
+
+void keyQueueClear(keyQueue* queue) {
+	if (!queue) { return; }
+
+	free(queue->keys);
+	keyQueueInit(queue);
+}
+
+void keyQueuePush(keyQueue* queue, int key) {
+	if (!queue) { return; }
+
+	// Reuse the space in front of the queue before growing it
+	if (queue->head > 0 && queue->head + queue->size >= queue->capacity) {
+		memmove(queue->keys, &queue->keys[queue->head], queue->size * sizeof(*queue->keys));
+		queue->head = 0;
+	}
+	if (queue->size >= queue->capacity) {
+		int newCapacity = (queue->capacity == 0) ? 64 : (queue->capacity * 2);
+		int* newKeys = realloc(queue->keys, newCapacity * sizeof(*newKeys));
+		if (!newKeys) { return; }
+		queue->keys = newKeys;
+		queue->capacity = newCapacity;
+	}
+	queue->keys[queue->head + queue->size++] = key;
+}
+
+void keyQueuePushStr(keyQueue* queue, const char* str) {
+	if (!queue || !str) { return; }
+
+	for(int i=0; str[i]; ++i) {
+		keyQueuePush(queue, (unsigned char)(str[i]));
+	}
+}
+
+int keyQueuePop(keyQueue* queue) {
+	if (!queue || queue->size == 0) { return ERR; }
+
+	queue->size--;
+	return queue->keys[queue->head++];
+}
+
+bool eventLoopInit(eventLoop* loop) {
+	if (!loop) { return false; }
+
+	loop->fd = epoll_create1(EPOLL_CLOEXEC);
+	loop->sources = NULL;
+	loop->numSources = 0;
+	loop->maxSources = 0;
+	return loop->fd >= 0;
+}
+
+void eventLoopClear(eventLoop* loop) {
+	if (!loop) { return; }
+
+	if (loop->fd >= 0) {
+		close(loop->fd);
+	}
+	free(loop->sources);
+	loop->fd = -1;
+	loop->sources = NULL;
+	loop->numSources = 0;
+	loop->maxSources = 0;
+}
+
+bool eventLoopAdd(eventLoop* loop, int fd, eventCallback callback, void* data) {
+	if (!loop || loop->fd < 0 || fd < 0 || !callback) { return false; }
+
+	// Resize array if necessary
+	if (loop->numSources >= loop->maxSources) {
+		int newSize = (loop->maxSources == 0) ? 4 : (loop->maxSources * 2);
+		eventSource* newSources = realloc(loop->sources, newSize * sizeof(*newSources));
+		if (!newSources) { return false; }
+		loop->sources = newSources;
+		loop->maxSources = newSize;
+	}
+
+	// Sources are looked up by descriptor, since the array moves when it grows
+	struct epoll_event event = { 0 };
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+	if (epoll_ctl(loop->fd, EPOLL_CTL_ADD, fd, &event) == -1) { return false; }
+	eventSource* source = &loop->sources[loop->numSources++];
+	source->fd = fd;
+	source->callback = callback;
+	source->data = data;
+	return true;
+}
+
+void eventLoopRemove(eventLoop* loop, int fd) {
+	if (!loop || loop->fd < 0) { return; }
+
+	for(int i=0; i<loop->numSources; ++i) {
+		if (loop->sources[i].fd == fd) {
+			epoll_ctl(loop->fd, EPOLL_CTL_DEL, fd, NULL);
+			loop->sources[i] = loop->sources[--loop->numSources];
+			return;
+		}
+	}
+}
+
+int eventLoopWait(eventLoop* loop, int delay) {
+	if (!loop || loop->fd < 0) { return -1; }
+
+	struct epoll_event events[NEO_MAX_EVENTS];
+	int num = epoll_wait(loop->fd, events, NEO_MAX_EVENTS, delay);
+	if (num == -1) {
+		return (errno == EINTR) ? 0 : -1;
+	}
+
+	// A callback may remove sources, so find each one again before running it
+	int ran = 0;
+	for(int i=0; i<num; ++i) {
+		for(int j=0; j<loop->numSources; ++j) {
+			eventSource source = loop->sources[j];
+			if (source.fd == events[i].data.fd) {
+				source.callback(source.data, source.fd, events[i].events);
+				ran++;
+				break;
+			}
+		}
+	}
+	return ran;
+}
+
+static void* workerPoolRun(void* arg) {
+	workerPool* pool = (workerPool*)(arg);
+
+	pthread_mutex_lock(&pool->lock);
+	while(1) {
+		// Keep going until told to stop and there's nothing left to do
+		while(!pool->queue && !pool->stop) {
+			pthread_cond_wait(&pool->wake, &pool->lock);
+		}
+		workerJob* job = pool->queue;
+		if (!job) { break; }
+		pool->queue = job->next;
+		if (!pool->queue) { pool->queueTail = NULL; }
+		pthread_mutex_unlock(&pool->lock);
+
+		job->run(job);
+
+		// Hand the job back to be collected
+		pthread_mutex_lock(&pool->lock);
+		job->next = NULL;
+		job->finished = true;
+		if (pool->doneTail) {
+			pool->doneTail->next = job;
+		} else {
+			pool->done = job;
+		}
+		pool->doneTail = job;
+		pool->numActive--;
+		pthread_cond_broadcast(&pool->finished);
+		uint64_t one = 1;
+		ssize_t written = write(pool->eventFd, &one, sizeof(one));
+		(void)(written);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+bool workerPoolInit(workerPool* pool, int maxThreads) {
+	if (!pool) { return false; }
+
+	if (maxThreads <= 0) {
+		maxThreads = (int)(sysconf(_SC_NPROCESSORS_ONLN));
+	}
+	pool->numThreads = 0;
+	pool->maxThreads = MAX(1, MIN(maxThreads, WORKER_MAX_THREADS));
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wake, NULL);
+	pthread_cond_init(&pool->finished, NULL);
+	pool->queue = NULL;
+	pool->queueTail = NULL;
+	pool->done = NULL;
+	pool->doneTail = NULL;
+	pool->numActive = 0;
+	pool->stop = false;
+	pool->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	return pool->eventFd >= 0;
+}
+
+void workerPoolClear(workerPool* pool) {
+	if (!pool) { return; }
+
+	// Threads drain the queue before stopping
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+	for(int i=0; i<pool->numThreads; ++i) {
+		pthread_join(pool->threads[i], NULL);
+	}
+	pool->numThreads = 0;
+	workerPoolCollect(pool);
+
+	pthread_cond_destroy(&pool->finished);
+	pthread_cond_destroy(&pool->wake);
+	pthread_mutex_destroy(&pool->lock);
+	if (pool->eventFd >= 0) {
+		close(pool->eventFd);
+		pool->eventFd = -1;
+	}
+}
+
+bool workerPoolSubmit(workerPool* pool, workerJob* job) {
+	if (!pool || !job || !job->run || !job->done) { return false; }
+
+	pthread_mutex_lock(&pool->lock);
+
+	// Start another thread while there are more jobs than threads to run them
+	if (pool->numThreads < pool->maxThreads && pool->numActive >= pool->numThreads) {
+		if (pthread_create(&pool->threads[pool->numThreads], NULL, workerPoolRun, pool) == 0) {
+			pool->numThreads++;
+		}
+	}
+	if (pool->numThreads == 0) {
+		pthread_mutex_unlock(&pool->lock);
+		return false;
+	}
+
+	// Add to the back of the queue
+	job->next = NULL;
+	job->finished = false;
+	if (pool->queueTail) {
+		pool->queueTail->next = job;
+	} else {
+		pool->queue = job;
+	}
+	pool->queueTail = job;
+	pool->numActive++;
+	pthread_cond_signal(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+	return true;
+}
+
+void workerPoolPromote(workerPool* pool, workerJob* job) {
+	if (!pool || !job) { return; }
+
+	pthread_mutex_lock(&pool->lock);
+
+	// Unlink the job if it's still queued, then put it back at the front
+	workerJob* prev = NULL;
+	workerJob* curr = pool->queue;
+	while(curr && curr != job) {
+		prev = curr;
+		curr = curr->next;
+	}
+	if (curr && prev) {
+		prev->next = job->next;
+		if (pool->queueTail == job) { pool->queueTail = prev; }
+		job->next = pool->queue;
+		pool->queue = job;
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void workerPoolWait(workerPool* pool, workerJob* job) {
+	if (!pool) { return; }
+
+	pthread_mutex_lock(&pool->lock);
+	while(job ? !job->finished : (pool->numActive > 0)) {
+		pthread_cond_wait(&pool->finished, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+int workerPoolCollect(workerPool* pool) {
+	if (!pool) { return 0; }
+
+	// Take the whole list, so done callbacks can submit more jobs
+	uint64_t count;
+	ssize_t got = read(pool->eventFd, &count, sizeof(count));
+	(void)(got);
+	pthread_mutex_lock(&pool->lock);
+	workerJob* job = pool->done;
+	pool->done = NULL;
+	pool->doneTail = NULL;
+	pthread_mutex_unlock(&pool->lock);
+
+	int num = 0;
+	while(job) {
+		workerJob* next = job->next;
+		job->done(job);
+		job = next;
+		num++;
+	}
+	return num;
+}
+
+bool workerPoolIsBusy(workerPool* pool) {
+	if (!pool) { return false; }
+
+	pthread_mutex_lock(&pool->lock);
+	bool busy = (pool->numActive > 0) || pool->done;
+	pthread_mutex_unlock(&pool->lock);
+	return busy;
+}
+
+void workerJobSetProgress(workerJob* job, uint64_t progress, uint64_t total) {
+	if (!job) { return; }
+
+	__atomic_store_n(&job->total, total, __ATOMIC_RELAXED);
+	__atomic_store_n(&job->progress, progress, __ATOMIC_RELAXED);
+}
+
+int workerJobGetPercent(workerJob* job) {
+	if (!job) { return 0; }
+
+	uint64_t total = __atomic_load_n(&job->total, __ATOMIC_RELAXED);
+	uint64_t progress = __atomic_load_n(&job->progress, __ATOMIC_RELAXED);
+	return (total > 0) ? (int)(MIN(progress, total) * 100 / total) : 0;
+}
 
 void strbufInit(strbuf* buf, unsigned int capacity) {
 	if (!buf) { return; }
@@ -86,7 +912,13 @@ void strbufInit(strbuf* buf, unsigned int capacity) {
 	buf->data = malloc(capacity);
 	buf->size = 0;
 	buf->capacity = capacity;
-	if (capacity > 0) { buf->data[0] = '\0'; }
+	buf->gap = 0;
+	buf->gapLen = 0;
+	if (!buf->data) {
+		buf->capacity = 0;
+		return;
+	}
+	buf->data[0] = '\0';
 }
 
 void strbufClear(strbuf* buf) {
@@ -96,10 +928,13 @@ void strbufClear(strbuf* buf) {
 	buf->data = NULL;
 	buf->size = 0;
 	buf->capacity = 0;
+	buf->gap = 0;
+	buf->gapLen = 0;
 }
 
 void strbufDelete(strbuf* buf, unsigned int at, int len) {
 	if (!buf || at >= buf->size || len == 0) { return; }
+	strbufCompact(buf);
 
 	// Check boundaries
 	if (at + len >= buf->size) { 
@@ -119,10 +954,12 @@ void strbufDelete(strbuf* buf, unsigned int at, int len) {
 
 void strbufAppend(strbuf* buf, const char* str, unsigned int len) {
 	if (!buf || !str || len == 0) { return; }
+	strbufCompact(buf);
 
 	// Resize if necessary
 	if (buf->size + len + 1 > buf->capacity) { 
 		strbufGrow(buf, buf->capacity + len + 1); 
+		if (buf->size + len + 1 > buf->capacity) { return; }
 	}
 
 	// Copy to end of buffer
@@ -133,10 +970,12 @@ void strbufAppend(strbuf* buf, const char* str, unsigned int len) {
 
 void strbufInsert(strbuf* buf, const char* str, unsigned int len, unsigned int at) {
 	if (!buf || !str || len == 0) { return; }
+	strbufCompact(buf);
 
 	// Resize if necessary
 	if (len + buf->size + 1 > buf->capacity) { 
 		strbufGrow(buf, buf->capacity + len + 1); 
+		if (len + buf->size + 1 > buf->capacity) { return; }
 	}
 
 	// Shift data around
@@ -149,10 +988,12 @@ void strbufInsert(strbuf* buf, const char* str, unsigned int len, unsigned int a
 
 void strbufSet(strbuf* buf, const char* str, unsigned int len, unsigned int at) {
 	if (!buf || !str || len == 0) { return; }
+	strbufCompact(buf);
 
 	// Resize if necessary
 	if (at + len + 1 > buf->capacity) { 
 		strbufGrow(buf, at + len + 1); 
+		if (at + len + 1 > buf->capacity) { return; }
 	}
 
 	// Overwrite data
@@ -165,9 +1006,11 @@ void strbufSet(strbuf* buf, const char* str, unsigned int len, unsigned int at)
 
 void strbufAddChar(strbuf* buf, char c) {
 	if (!buf) { return; }
+	strbufCompact(buf);
 
 	if (buf->size + 1 >= buf->capacity) { 
 		strbufGrow(buf, buf->capacity + 1); 
+		if (buf->size + 1 >= buf->capacity) { return; }
 	}
 	buf->data[buf->size++] = c;
 	buf->data[buf->size] = '\0';
@@ -175,6 +1018,7 @@ void strbufAddChar(strbuf* buf, char c) {
 
 void strbufDelChar(strbuf* buf) {
 	if (!buf) { return; }
+	strbufCompact(buf);
 
 	if (buf->size > 0) { 
 		buf->data[--buf->size] = '\0'; 
@@ -190,10 +1034,14 @@ char strbufGetChar(strbuf* buf, int at) {
 	if ((unsigned int)(at) >= buf->size) { 
 		return '\0'; 
 	}
+	if (buf->gapLen > 0 && (unsigned int)(at) >= buf->gap) {
+		return buf->data[at + buf->gapLen];
+	}
 	return buf->data[at];
 }
 
 void strbufGrow(strbuf* buf, unsigned int min_size) {
+	strbufCompact(buf);
 	unsigned int newCapacity = buf->capacity;
 	while (newCapacity < min_size) { 
 		newCapacity = (newCapacity <= 1) ? 40 : newCapacity * 2; 
@@ -207,257 +1055,3333 @@ void strbufGrow(strbuf* buf, unsigned int min_size) {
 
 int strbufLength(strbuf* buf) {
 	if (!buf) { return 0; }
+	strbufCompact(buf);
 	return strlen(buf->data);
 }
 
-void rowInit(editorRow* row) {
-	if (!row) { return; }
+static void strbufGapOpen(strbuf* buf, unsigned int min_gap) {
+	// A contiguous buffer's spare capacity becomes the gap, placed at the end
+	if (buf->gapLen == 0) {
+		buf->gap = buf->size;
+		buf->gapLen = buf->capacity - buf->size;
+	}
+	if (buf->gapLen >= min_gap) { return; }
 
-	strbufInit(&row->text, 1);
-	strbufInit(&row->rtext, 1);
-	row->dirty = false;
+	// Grow the buffer and move the text after the gap to the new end
+	unsigned int newCapacity = MAX(buf->capacity, 40u);
+	while(newCapacity - buf->size < min_gap) { 
+		newCapacity *= 2; 
+	}
+	char* newData = realloc(buf->data, newCapacity);
+	if (!newData) { return; }
+	unsigned int tail = buf->size - buf->gap;
+	memmove(&newData[newCapacity - tail], &newData[buf->gap + buf->gapLen], tail);
+	buf->data = newData;
+	buf->gapLen = newCapacity - buf->size;
+	buf->capacity = newCapacity;
 }
 
-void rowClear(editorRow* row) {
-	if (!row) { return; }
-
-	strbufClear(&row->text);
-	strbufClear(&row->rtext);
+static void strbufGapMove(strbuf* buf, unsigned int at) {
+	if (at < buf->gap) {
+		memmove(&buf->data[at + buf->gapLen], &buf->data[at], buf->gap - at);
+	} else if (at > buf->gap) {
+		memmove(&buf->data[buf->gap], &buf->data[buf->gap + buf->gapLen], at - buf->gap);
+	}
+	buf->gap = at;
 }
 
-void rowUpdate(editorContext* ctx, editorRow* row) {
-	if (!row || !row->dirty) { return; }
+void strbufGapInsert(strbuf* buf, const char* str, unsigned int len, unsigned int at) {
+	if (!buf || !str || len == 0) { return; }
 
-	// Clear render buffer
-	strbufDelete(&row->rtext, 0, -1);
+	// Keep at least one spare byte so the buffer can always be compacted in place
+	if (at > buf->size) { at = buf->size; }
+	strbufGapOpen(buf, len + 1);
+	if (buf->gapLen < len + 1) { return; }
 
-	// Render text
-	for(unsigned int j=0; j<row->text.size; ++j) {
-		if (strbufGetChar(&row->text, j) == '\t') {
-			strbufAddChar(&row->rtext, ' ');
-			while(row->rtext.size % ctx->settingTabStop != 0) { 
-				strbufAddChar(&row->rtext, ' '); 
-			}
-		} else {
-			strbufAddChar(&row->rtext, strbufGetChar(&row->text, j));
-		}
+	// Fill the start of the gap
+	strbufGapMove(buf, at);
+	memcpy(&buf->data[buf->gap], str, len);
+	buf->gap += len;
+	buf->gapLen -= len;
+	buf->size += len;
+}
+
+void strbufGapDelete(strbuf* buf, unsigned int at, unsigned int len) {
+	if (!buf || at >= buf->size || len == 0) { return; }
+
+	// Widen the gap over the deleted text
+	if (len > buf->size - at) { len = buf->size - at; }
+	strbufGapOpen(buf, 1);
+	strbufGapMove(buf, at);
+	buf->gapLen += len;
+	buf->size -= len;
+}
+
+void strbufGetSpans(strbuf* buf, textPiece spans[2]) {
+	if (!buf || !spans) { return; }
+
+	if (buf->gapLen == 0) {
+		spans[0].data = buf->data;
+		spans[0].len = buf->size;
+		spans[1].data = NULL;
+		spans[1].len = 0;
+	} else {
+		spans[0].data = buf->data;
+		spans[0].len = buf->gap;
+		spans[1].data = &buf->data[buf->gap + buf->gapLen];
+		spans[1].len = buf->size - buf->gap;
+	}
+}
+
+char* strbufCompact(strbuf* buf) {
+	if (!buf) { return NULL; }
+	if (buf->gapLen == 0) { return buf->data; }
+
+	// Close the gap and restore the terminator
+	memmove(&buf->data[buf->gap], &buf->data[buf->gap + buf->gapLen], buf->size - buf->gap);
+	buf->gap = 0;
+	buf->gapLen = 0;
+	buf->data[buf->size] = '\0';
+	return buf->data;
+}
+
+void pieceTableInit(pieceTable* table) {
+	if (!table) { return; }
+
+	table->original = NULL;
+	table->originalSize = 0;
+	table->append = NULL;
+	table->mapped = false;
+	table->fd = -1;
+}
+
+// Mappings whose file might be truncated under them. The fault handler reads
+// these without locking, so a range's size is always set before its start
+typedef struct {
+	char* start;
+	size_t size;
+} pieceMapping;
+
+static pieceMapping pieceMappings[PIECE_MAX_MAPPED];
+static pthread_mutex_t pieceMappingsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t pieceFaultOnce = PTHREAD_ONCE_INIT;
+
+static void pieceTableOnFault(int sig, siginfo_t* info, void* context) {
+	(void)(context);
+
+	// Reading past the end of a truncated file leaves zeros in place of the
+	// text that went with it. mmap is only a system call here, so it's safe
+	// to make from a signal handler
+	char* addr = (char*)(info->si_addr);
+	for(int i=0; i<PIECE_MAX_MAPPED; ++i) {
+		char* start = __atomic_load_n(&pieceMappings[i].start, __ATOMIC_ACQUIRE);
+		if (!start || addr < start || addr >= start + pieceMappings[i].size) { continue; }
+		uintptr_t pageSize = (uintptr_t)(sysconf(_SC_PAGESIZE));
+		void* page = (void*)((uintptr_t)(addr) & ~(pageSize - 1));
+		if (mmap(page, pageSize, PROT_READ, MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) != MAP_FAILED) { return; }
+		break;
+	}
+
+	// Anything else is a real crash, which happens again once this returns
+	signal(sig, SIG_DFL);
+}
+
+static void pieceTableInstallFault() {
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = pieceTableOnFault;
+	action.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGBUS, &action, NULL);
+}
+
+static bool pieceTableGuard(char* start, size_t size) {
+	pthread_once(&pieceFaultOnce, pieceTableInstallFault);
+	pthread_mutex_lock(&pieceMappingsLock);
+	bool guarded = false;
+	for(int i=0; i<PIECE_MAX_MAPPED && !guarded; ++i) {
+		if (pieceMappings[i].start) { continue; }
+		pieceMappings[i].size = size;
+		__atomic_store_n(&pieceMappings[i].start, start, __ATOMIC_RELEASE);
+		guarded = true;
+	}
+	pthread_mutex_unlock(&pieceMappingsLock);
+	return guarded;
+}
+
+static void pieceTableUnguard(char* start) {
+	pthread_mutex_lock(&pieceMappingsLock);
+	for(int i=0; i<PIECE_MAX_MAPPED; ++i) {
+		if (pieceMappings[i].start == start) {
+			__atomic_store_n(&pieceMappings[i].start, NULL, __ATOMIC_RELEASE);
+		}
+	}
+	pthread_mutex_unlock(&pieceMappingsLock);
+}
+
+static void pieceTableCloseFile(pieceTable* table) {
+	if (table->fd < 0) { return; }
+	pieceTableUnguard(table->original);
+	close(table->fd);
+	table->fd = -1;
+}
+
+static void pieceTableReleaseOriginal(pieceTable* table) {
+	pieceTableCloseFile(table);
+	if (table->mapped) {
+		munmap(table->original, table->originalSize);
+	} else {
+		free(table->original);
+	}
+	table->original = NULL;
+	table->originalSize = 0;
+	table->mapped = false;
+}
+
+void pieceTableClear(pieceTable* table) {
+	if (!table) { return; }
+
+	pieceTableReleaseOriginal(table);
+	while(table->append) {
+		pieceBlock* next = table->append->next;
+		free(table->append);
+		table->append = next;
+	}
+}
+
+bool pieceTableLoad(pieceTable* table, FILE* fp) {
+	if (!table || !fp) { return false; }
+
+	// Map large regular files instead of copying them
+	struct stat st;
+	int fd = fileno(fp);
+	if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= PIECE_MMAP_MIN_SIZE) {
+		// The file is kept open to check it hasn't changed since. When too many
+		// files are mapped to guard another one, it's read like the others
+		int mapFd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+		void* map = (mapFd >= 0) ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+		if (map != MAP_FAILED && pieceTableGuard(map, st.st_size)) {
+			pieceTableReleaseOriginal(table);
+			table->original = map;
+			table->originalSize = st.st_size;
+			table->mapped = true;
+			table->fd = mapFd;
+			table->mtime = st.st_mtim;
+			return true;
+		}
+		if (map != MAP_FAILED) { munmap(map, st.st_size); }
+		if (mapFd >= 0) { close(mapFd); }
+	}
+
+	// Read the whole file in one go, growing the buffer for streams of unknown size
+	size_t capacity = PIECE_BLOCK_SIZE;
+	size_t size = 0;
+	char* data = malloc(capacity);
+	if (!data) { return false; }
+	while(1) {
+		size += fread(&data[size], 1, capacity - size, fp);
+		if (size < capacity) { break; }
+		char* newData = realloc(data, capacity * 2);
+		if (!newData) {
+			free(data);
+			return false;
+		}
+		data = newData;
+		capacity *= 2;
+	}
+	if (ferror(fp)) {
+		free(data);
+		return false;
+	}
+
+	pieceTableReleaseOriginal(table);
+	table->original = data;
+	table->originalSize = size;
+	return true;
+}
+
+bool pieceTableDetach(pieceTable* table) {
+	if (!table || !table->mapped || table->originalSize == 0) { return true; }
+
+	// Even private copies of a file's pages are dropped when it's truncated, so
+	// the mapping is replaced with anonymous memory a piece at a time. The rows
+	// keep pointing at the same addresses
+	char* copy = malloc(PIECE_DETACH_SIZE);
+	if (!copy) { return false; }
+	for(size_t at=0; at<table->originalSize; at+=PIECE_DETACH_SIZE) {
+		size_t len = MIN((size_t)PIECE_DETACH_SIZE, table->originalSize - at);
+		memcpy(copy, &table->original[at], len);
+		if (mmap(&table->original[at], len, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) == MAP_FAILED) {
+			free(copy);
+			return false;
+		}
+		memcpy(&table->original[at], copy, len);
+		mprotect(&table->original[at], len, PROT_READ);
+	}
+	free(copy);
+	pieceTableCloseFile(table);
+	return true;
+}
+
+bool pieceTableChanged(pieceTable* table) {
+	if (!table || table->fd < 0) { return false; }
+
+	struct stat st;
+	if (fstat(table->fd, &st) != 0) { return false; }
+	return (size_t)(st.st_size) != table->originalSize || 
+		st.st_mtim.tv_sec != table->mtime.tv_sec || 
+		st.st_mtim.tv_nsec != table->mtime.tv_nsec;
+}
+
+const char* pieceTableAppend(pieceTable* table, const char* str, unsigned int len) {
+	if (!table || !str || len == 0) { return NULL; }
+
+	// Start a new block if the current one is full
+	pieceBlock* block = table->append;
+	if (!block || block->size + len > block->capacity) {
+		size_t capacity = MAX((size_t)PIECE_BLOCK_SIZE, (size_t)len);
+		block = malloc(sizeof(*block) + capacity);
+		if (!block) { return NULL; }
+		block->next = table->append;
+		block->size = 0;
+		block->capacity = capacity;
+		table->append = block;
+	}
+
+	// Copy to end of block
+	char* dest = &block->data[block->size];
+	memcpy(dest, str, len);
+	block->size += len;
+	return dest;
+}
+
+static size_t lineScanScalar(const char* data, size_t len, uint32_t* out) {
+	size_t num = 0;
+	const char* end = data + len;
+	for(const char* c = data; (c = memchr(c, '\n', end - c)); ++c) {
+		out[num++] = c - data;
+	}
+	return num;
+}
+
+#ifdef NEO_X86
+__attribute__((target("sse2")))
+static size_t lineScanSSE2(const char* data, size_t len, uint32_t* out) {
+	size_t num = 0;
+	size_t i = 0;
+
+	// Compare 16 bytes at a time and walk the set bits of the match mask
+	const __m128i newline = _mm_set1_epi8('\n');
+	for(; i + 16 <= len; i += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i*)&data[i]);
+		unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+		while(mask) {
+			out[num++] = i + __builtin_ctz(mask);
+			mask &= mask - 1;
+		}
+	}
+	for(; i<len; ++i) {
+		if (data[i] == '\n') { out[num++] = i; }
+	}
+	return num;
+}
+
+__attribute__((target("avx2")))
+static size_t lineScanAVX2(const char* data, size_t len, uint32_t* out) {
+	size_t num = 0;
+	size_t i = 0;
+
+	// Compare 32 bytes at a time and walk the set bits of the match mask
+	const __m256i newline = _mm256_set1_epi8('\n');
+	for(; i + 32 <= len; i += 32) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i*)&data[i]);
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newline));
+		while(mask) {
+			out[num++] = i + __builtin_ctz(mask);
+			mask &= mask - 1;
+		}
+	}
+	for(; i<len; ++i) {
+		if (data[i] == '\n') { out[num++] = i; }
+	}
+	return num;
+}
+#endif
+
+fptrLineScanner lineScannerGet() {
+#ifdef NEO_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) { return lineScanAVX2; }
+	if (__builtin_cpu_supports("sse2")) { return lineScanSSE2; }
+#endif
+	return lineScanScalar;
+}
+
+static bool hugeFileAddCheckpoint(hugeFile* huge, int64_t offset) {
+	if (huge->numCheckpoints >= huge->maxCheckpoints) {
+		int64_t newSize = (huge->maxCheckpoints == 0) ? 1024 : (huge->maxCheckpoints * 2);
+		int64_t* newCheckpoints = realloc(huge->checkpoints, newSize * sizeof(*newCheckpoints));
+		if (!newCheckpoints) { return false; }
+		huge->checkpoints = newCheckpoints;
+		huge->maxCheckpoints = newSize;
+	}
+	huge->checkpoints[huge->numCheckpoints++] = offset;
+	return true;
+}
+
+static void* hugeFileIndex(void* data) {
+	hugeFile* huge = (hugeFile*)(data);
+	fptrLineScanner scan = lineScannerGet();
+	char* buf = malloc(LOAD_SCAN_BLOCK);
+	uint32_t* newlines = malloc(LOAD_SCAN_BLOCK * sizeof(*newlines));
+
+	// Count lines a block at a time, remembering where every checkpoint line starts
+	int64_t offset = 0;
+	int64_t lines = 0;
+	char last = '\n';
+	bool stop = (!buf || !newlines);
+	while(!stop && offset < huge->fileSize) {
+		ssize_t len = pread(huge->fd, buf, LOAD_SCAN_BLOCK, offset);
+		if (len <= 0) { break; }
+		size_t num = scan(buf, len, newlines);
+		last = buf[len - 1];
+
+		pthread_mutex_lock(&huge->lock);
+		for(size_t i=0; i<num && !stop; ++i) {
+			if (++lines % HUGE_CHECKPOINT_LINES == 0) {
+				stop = !hugeFileAddCheckpoint(huge, offset + newlines[i] + 1);
+			}
+		}
+		offset += len;
+		huge->numLines = lines;
+		huge->indexedSize = offset;
+		stop |= huge->stop;
+		pthread_mutex_unlock(&huge->lock);
+	}
+
+	// Last line of the file may not end in a newline
+	pthread_mutex_lock(&huge->lock);
+	if (offset >= huge->fileSize && last != '\n') {
+		huge->numLines++;
+	}
+	huge->done = true;
+	pthread_mutex_unlock(&huge->lock);
+	free(buf);
+	free(newlines);
+	return NULL;
+}
+
+static bool hugeFileSkipLines(hugeFile* huge, int64_t* offset, int64_t end, int64_t* num) {
+	// Read forward until either enough newlines have been passed or the end is reached
+	char buf[LOAD_SCAN_BLOCK];
+	int64_t pos = *offset;
+	int64_t count = 0;
+	while(pos < end && count < *num) {
+		ssize_t len = pread(huge->fd, buf, MIN((int64_t)sizeof(buf), end - pos), pos);
+		if (len < 0) { return false; }
+		if (len == 0) { break; }
+		const char* line = buf;
+		const char* newline = NULL;
+		while(count < *num && (newline = memchr(line, '\n', &buf[len] - line))) {
+			count++;
+			line = newline + 1;
+		}
+		pos += (count < *num) ? len : (line - buf);
+	}
+	*offset = pos;
+	*num = count;
+	return true;
+}
+
+hugeFile* hugeFileOpen(int fd, int64_t size) {
+	hugeFile* huge = calloc(1, sizeof(*huge));
+	if (!huge) {
+		close(fd);
+		return NULL;
+	}
+	huge->fd = fd;
+	huge->fileSize = size;
+	pthread_mutex_init(&huge->lock, NULL);
+
+	// First line always starts at the beginning of the file
+	if (!hugeFileAddCheckpoint(huge, 0) || pthread_create(&huge->thread, NULL, hugeFileIndex, huge) != 0) {
+		pthread_mutex_destroy(&huge->lock);
+		free(huge->checkpoints);
+		free(huge);
+		close(fd);
+		return NULL;
+	}
+	return huge;
+}
+
+void hugeFileClose(hugeFile* huge) {
+	if (!huge) { return; }
+
+	pthread_mutex_lock(&huge->lock);
+	huge->stop = true;
+	pthread_mutex_unlock(&huge->lock);
+	pthread_join(huge->thread, NULL);
+	pthread_mutex_destroy(&huge->lock);
+	free(huge->checkpoints);
+	close(huge->fd);
+	free(huge);
+}
+
+bool hugeFileProgress(hugeFile* huge, int64_t* lines, int* percent) {
+	if (!huge) { return true; }
+
+	pthread_mutex_lock(&huge->lock);
+	if (lines) { *lines = huge->numLines; }
+	if (percent) { *percent = (int)((huge->indexedSize * 100) / MAX(1, huge->fileSize)); }
+	bool done = huge->done;
+	pthread_mutex_unlock(&huge->lock);
+	return done;
+}
+
+bool hugeFileFindLine(hugeFile* huge, int64_t line, int64_t* offset) {
+	if (!huge || !offset || line < 0) { return false; }
+
+	// Jump straight to the checkpoint before the line
+	pthread_mutex_lock(&huge->lock);
+	int64_t checkpoint = line / HUGE_CHECKPOINT_LINES;
+	bool indexed = (checkpoint < huge->numCheckpoints);
+	int64_t pos = indexed ? huge->checkpoints[checkpoint] : 0;
+	pthread_mutex_unlock(&huge->lock);
+	if (!indexed) { return false; }
+
+	// Skip the lines in between
+	int64_t skip = line - (checkpoint * HUGE_CHECKPOINT_LINES);
+	int64_t num = skip;
+	if (!hugeFileSkipLines(huge, &pos, huge->fileSize, &num) || num < skip) { return false; }
+	if (pos >= huge->fileSize && line > 0) { return false; }
+	*offset = pos;
+	return true;
+}
+
+bool hugeFileFindOffset(hugeFile* huge, int64_t offset, int64_t* line) {
+	if (!huge || !line || offset < 0 || offset >= huge->fileSize) { return false; }
+
+	// Binary search for the last checkpoint at or before the offset
+	pthread_mutex_lock(&huge->lock);
+	bool indexed = (huge->done || offset < huge->indexedSize);
+	int64_t lo = 0;
+	int64_t hi = huge->numCheckpoints - 1;
+	while(lo < hi) {
+		int64_t mid = lo + (hi - lo + 1) / 2;
+		if (huge->checkpoints[mid] <= offset) { lo = mid; }
+		else { hi = mid - 1; }
+	}
+	int64_t pos = huge->checkpoints[lo];
+	pthread_mutex_unlock(&huge->lock);
+	if (!indexed) { return false; }
+
+	// Count the lines in between
+	int64_t num = INT64_MAX;
+	if (!hugeFileSkipLines(huge, &pos, offset, &num)) { return false; }
+	*line = (lo * HUGE_CHECKPOINT_LINES) + num;
+	return true;
+}
+
+static bool fileWriteSpans(int fd, struct iovec* spans, int num) {
+	// Keep writing until every span is out, since writes can be cut short
+	while(num > 0) {
+		ssize_t written = writev(fd, spans, num);
+		if (written < 0) {
+			if (errno != EINTR) { return false; }
+			continue;
+		}
+		while(num > 0 && (size_t)(written) >= spans->iov_len) {
+			written -= spans->iov_len;
+			spans++;
+			num--;
+		}
+		if (num > 0) {
+			spans->iov_base = (char*)(spans->iov_base) + written;
+			spans->iov_len -= written;
+		}
+	}
+	return true;
+}
+
+void contentHashInit(contentHash* hash) {
+	if (!hash) { return; }
+
+	hash->state = 0;
+	hash->tail = 0;
+	hash->size = 0;
+}
+
+static uint64_t contentHashMix(uint64_t state, uint64_t word) {
+	state = (state ^ word) * 0x9e3779b97f4a7c15ULL;
+	return state ^ (state >> 32);
+}
+
+void contentHashUpdate(contentHash* hash, const void* data, size_t len) {
+	if (!hash || !data) { return; }
+
+	// Finish the word left over from the last piece, so the hash doesn't
+	// depend on how the contents were split up
+	const unsigned char* bytes = data;
+	size_t used = hash->size % 8;
+	hash->size += len;
+	for(; used > 0 && used < 8 && len > 0; ++used, ++bytes, --len) {
+		hash->tail |= (uint64_t)(*bytes) << (used * 8);
+	}
+	if (used == 8) {
+		hash->state = contentHashMix(hash->state, hash->tail);
+		hash->tail = 0;
+	}
+
+	// Then take a word at a time
+	for(; len >= 8; len -= 8, bytes += 8) {
+		uint64_t word;
+		memcpy(&word, bytes, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		word = __builtin_bswap64(word);
+#endif
+		hash->state = contentHashMix(hash->state, word);
+	}
+	for(size_t i=0; i<len; ++i) {
+		hash->tail |= (uint64_t)(bytes[i]) << (i * 8);
+	}
+}
+
+uint64_t contentHashFinal(contentHash* hash) {
+	if (!hash) { return 0; }
+
+	uint64_t state = contentHashMix(contentHashMix(hash->state, hash->tail), hash->size);
+	return contentHashMix(state, state >> 29);
+}
+
+/// @brief Entry in a journal file. Ops are followed by their text, while
+/// @brief marks use len and hash for the size and hash of the saved file.
+typedef struct {
+	uint32_t type;
+	int32_t index;
+	int32_t kind;
+	int32_t row, col;
+	int32_t cx, cy;
+	uint32_t reserved;
+	uint64_t len;
+	uint64_t hash;
+} undoRecord;
+
+enum undoRecordType {
+	UR_OP = 1,
+	UR_MARK
+};
+
+void undoJournalInit(undoJournal* undo, size_t limit) {
+	if (!undo) { return; }
+
+	undo->ops = NULL;
+	undo->firstOp = 0;
+	undo->current = 0;
+	undo->numOps = 0;
+	undo->maxOps = 0;
+	undo->text = NULL;
+	undo->textStart = 0;
+	undo->textSize = 0;
+	undo->textCapacity = 0;
+	undo->limit = limit;
+	undo->merge = false;
+	undo->path = NULL;
+	undo->fd = -1;
+	undo->map = NULL;
+	undo->mapSize = 0;
+	undo->fileSize = 0;
+	undo->numStored = 0;
+	undo->baseOp = 0;
+	undo->minChanged = INT_MAX;
+	undo->broken = false;
+	undo->writing = false;
+}
+
+static void undoJournalClose(undoJournal* undo) {
+	if (undo->map) { munmap(undo->map, undo->mapSize); }
+	if (undo->fd >= 0) { close(undo->fd); }
+	free(undo->path);
+	undo->path = NULL;
+	undo->fd = -1;
+	undo->map = NULL;
+	undo->mapSize = 0;
+	undo->fileSize = 0;
+	undo->broken = false;
+}
+
+void undoJournalClear(undoJournal* undo) {
+	if (!undo) { return; }
+
+	// The file is only closed, since it still holds the history of the file as it was last saved
+	undoJournalClose(undo);
+	free(undo->ops);
+	free(undo->text);
+	undoJournalInit(undo, undo->limit);
+}
+
+size_t undoJournalSize(undoJournal* undo) {
+	if (!undo) { return 0; }
+
+	return (undo->textSize - undo->textStart) + (size_t)(undo->numOps - undo->firstOp) * sizeof(*undo->ops);
+}
+
+const char* undoJournalText(undoJournal* undo, const undoOp* op) {
+	if (!undo || !op) { return NULL; }
+
+	return op->stored ? &undo->map[op->offset] : &undo->text[op->offset];
+}
+
+static bool undoJournalReserve(undoJournal* undo, size_t len) {
+	if (undo->textSize + len <= undo->textCapacity) { return true; }
+
+	size_t capacity = MAX(undo->textCapacity * 2, undo->textSize + len);
+	char* text = realloc(undo->text, MAX(capacity, (size_t)PIECE_BLOCK_SIZE));
+	if (!text) { return false; }
+	undo->text = text;
+	undo->textCapacity = MAX(capacity, (size_t)PIECE_BLOCK_SIZE);
+	return true;
+}
+
+static bool undoJournalReserveOps(undoJournal* undo, int num) {
+	if (num <= undo->maxOps) { return true; }
+
+	int maxOps = MAX(MAX(undo->maxOps * 2, num), 64);
+	undoOp* ops = realloc(undo->ops, maxOps * sizeof(*ops));
+	if (!ops) { return false; }
+	undo->ops = ops;
+	undo->maxOps = maxOps;
+	return true;
+}
+
+static void undoJournalCompact(undoJournal* undo) {
+	// Move the ops still in the history back to the start of the buffers
+	if (undo->numOps < undo->firstOp) { return; }
+	int num = undo->numOps - undo->firstOp;
+	memmove(undo->ops, &undo->ops[undo->firstOp], num * sizeof(*undo->ops));
+	if (undo->textSize > undo->textStart) {
+		memmove(undo->text, &undo->text[undo->textStart], undo->textSize - undo->textStart);
+	}
+	for(int i=0; i<num; ++i) {
+		if (!undo->ops[i].stored) {
+			undo->ops[i].offset -= undo->textStart;
+		}
+	}
+	undo->current -= undo->firstOp;
+	undo->numOps = num;
+	undo->numStored = MAX(undo->numStored - undo->firstOp, 0);
+	undo->baseOp += undo->firstOp;
+	undo->firstOp = 0;
+	undo->textSize -= undo->textStart;
+	undo->textStart = 0;
+}
+
+static void undoJournalChanged(undoJournal* undo, int at) {
+	undo->minChanged = MIN(undo->minChanged, undo->baseOp + at);
+}
+
+static bool undoJournalMerge(undoJournal* undo, int kind, int row, int col, const char* text, size_t len) {
+	// Only runs of short edits within one row are merged, and never into ops already in the file
+	if (!undo->merge || undo->numOps == undo->firstOp || undo->ops[undo->numOps - 1].stored) { return false; }
+	undoOp* last = &undo->ops[undo->numOps - 1];
+	const char* lastText = &undo->text[last->offset];
+	if (last->kind != kind || last->row != row || last->len + len > UNDO_MERGE_MAX) { return false; }
+	if (memchr(text, '\n', len) || memchr(lastText, '\n', last->len)) { return false; }
+
+	// Typing past the end of a word starts a new op, so words are undone one at a time
+	size_t at = 0;
+	if (kind == UK_INSERT) {
+		if ((size_t)col != last->col + last->len) { return false; }
+		if (isblank(text[0]) && !isblank(lastText[last->len - 1])) { return false; }
+		at = last->len;
+	} else if ((size_t)col + len == (size_t)last->col) {
+		// Deleting backwards adds to the start of the text
+		at = 0;
+	} else if (col == last->col) {
+		at = last->len;
+	} else {
+		return false;
+	}
+	if (!undoJournalReserve(undo, len)) { return false; }
+	char* dest = &undo->text[last->offset];
+	memmove(&dest[at + len], &dest[at], last->len - at);
+	memcpy(&dest[at], text, len);
+	if (at == 0) { last->col = col; }
+	last->len += len;
+	undo->textSize += len;
+	undoJournalChanged(undo, undo->numOps - 1);
+	return true;
+}
+
+static void undoJournalTrim(undoJournal* undo) {
+	// Ops in the file only cost their place in the list, so write them out before dropping any
+	if (undoJournalSize(undo) > undo->limit && undo->textSize > undo->textStart) {
+		undoJournalFlush(undo);
+	}
+
+	// Drop the oldest ops until the history fits in its limit again. Ops that
+	// can still be redone are kept, or the current position would be dropped
+	// too, and so are ops waiting on a save to write them, or the file would
+	// be left with a gap in it
+	int keep = undo->writing ? undo->numStored : INT_MAX;
+	while(undoJournalSize(undo) > undo->limit && undo->firstOp < MIN(MIN(undo->current, undo->numOps - 1), keep)) {
+		undo->firstOp++;
+		if (!undo->ops[undo->firstOp].stored) {
+			undo->textStart = undo->ops[undo->firstOp].offset;
+		}
+	}
+}
+
+bool undoJournalRecord(undoJournal* undo, int kind, int row, int col, const char* text, size_t len, int cx, int cy) {
+	if (!undo || !text || len == 0) { return false; }
+
+	// A new edit replaces everything that was undone
+	if (undo->current < undo->numOps) {
+		undo->numOps = MAX(undo->current, undo->firstOp);
+		undo->numStored = MIN(undo->numStored, undo->numOps);
+		undo->textSize = (undo->numOps > undo->firstOp && !undo->ops[undo->numOps - 1].stored) ? undo->ops[undo->numOps - 1].offset + undo->ops[undo->numOps - 1].len : undo->textStart;
+		undo->merge = false;
+		undoJournalChanged(undo, undo->numOps);
+	}
+	if (undoJournalMerge(undo, kind, row, col, text, len)) { return true; }
+
+	// Edits too big to keep at all leave nothing before them that could be
+	// undone, unless they can go straight to the file
+	bool stored = (undo->fd >= 0 && !undo->broken);
+	if (!stored && len + sizeof(*undo->ops) > undo->limit) {
+		undoJournalClear(undo);
+		return false;
+	}
+	if (undo->firstOp > 0 && undo->firstOp >= undo->numOps - undo->firstOp) {
+		undoJournalCompact(undo);
+	}
+	if (!undoJournalReserveOps(undo, undo->numOps + 1) || !undoJournalReserve(undo, len)) {
+		undoJournalClear(undo);
+		return false;
+	}
+
+	// Append the op and its text
+	undoOp* op = &undo->ops[undo->numOps++];
+	op->kind = kind;
+	op->row = row;
+	op->col = col;
+	op->cx = cx;
+	op->cy = cy;
+	op->offset = undo->textSize;
+	op->len = len;
+	op->stored = false;
+	memcpy(&undo->text[undo->textSize], text, len);
+	undo->textSize += len;
+	undo->current = undo->numOps;
+	undo->merge = true;
+	undoJournalChanged(undo, undo->numOps - 1);
+
+	// Write out a batch once enough text has built up
+	if (stored && undo->textSize - undo->textStart >= UNDO_BATCH_SIZE) {
+		undoJournalFlush(undo);
+	}
+	undoJournalTrim(undo);
+	return true;
+}
+
+void undoJournalSeal(undoJournal* undo) {
+	if (!undo) { return; }
+
+	undo->merge = false;
+}
+
+const undoOp* undoJournalUndo(undoJournal* undo) {
+	if (!undo || undo->current <= undo->firstOp) { return NULL; }
+
+	undo->merge = false;
+	return &undo->ops[--undo->current];
+}
+
+const undoOp* undoJournalRedo(undoJournal* undo) {
+	if (!undo || undo->current >= undo->numOps) { return NULL; }
+
+	undo->merge = false;
+	return &undo->ops[undo->current++];
+}
+
+static bool undoJournalMap(undoJournal* undo) {
+	// Map the whole file again, now that it's grown
+	if (undo->map) {
+		munmap(undo->map, undo->mapSize);
+		undo->map = NULL;
+		undo->mapSize = 0;
+	}
+	void* map = mmap(NULL, undo->fileSize, PROT_READ, MAP_SHARED, undo->fd, 0);
+	if (map == MAP_FAILED) { return false; }
+	undo->map = map;
+	undo->mapSize = undo->fileSize;
+	return true;
+}
+
+static bool undoJournalOpen(undoJournal* undo, const char* path, int flags) {
+	undo->fd = open(path, O_RDWR | O_CLOEXEC | flags, 0600);
+	undo->path = strdup(path);
+	if (undo->fd < 0 || !undo->path) {
+		undoJournalClose(undo);
+		return false;
+	}
+	return true;
+}
+
+static bool undoJournalCapture(undoJournal* undo, const char* path, undoBatch* batch) {
+	memset(batch, 0, sizeof(*batch));
+	batch->fd = -1;
+	if (undo->writing) { return false; }
+
+	// A new file gets the whole history, numbered from the start again. Ops
+	// kept in the old file are read through a mapping of its own, since the
+	// journal's can go while the batch is being written
+	int first = MAX(undo->numStored, undo->firstOp);
+	if (path) {
+		if (undo->firstOp > 0) {
+			undoJournalCompact(undo);
+		}
+		undo->baseOp = 0;
+		undo->numStored = 0;
+		first = 0;
+		batch->path = strdup(path);
+		batch->offset = sizeof(UNDO_FILE_MAGIC) - 1;
+		if (!batch->path) { return false; }
+		if (undo->map) {
+			void* map = mmap(NULL, undo->mapSize, PROT_READ, MAP_SHARED, undo->fd, 0);
+			if (map == MAP_FAILED) {
+				undoBatchClear(batch);
+				return false;
+			}
+			batch->map = map;
+			batch->mapSize = undo->mapSize;
+		}
+	} else {
+		batch->fd = fcntl(undo->fd, F_DUPFD_CLOEXEC, 0);
+		batch->offset = undo->fileSize;
+		if (batch->fd < 0) { return false; }
+	}
+
+	// Copy the ops and the text that's only in memory, which goes on changing
+	batch->first = undo->baseOp + first;
+	batch->numOps = MAX(undo->numOps - first, 0);
+	batch->ops = malloc(MAX(batch->numOps, 1) * sizeof(*batch->ops));
+	batch->textStart = undo->textStart;
+	batch->text = malloc(MAX(undo->textSize - undo->textStart, (size_t)1));
+	if (!batch->ops || !batch->text) {
+		undoBatchClear(batch);
+		return false;
+	}
+	memcpy(batch->ops, &undo->ops[first], batch->numOps * sizeof(*batch->ops));
+	if (undo->textSize > undo->textStart) {
+		memcpy(batch->text, &undo->text[undo->textStart], undo->textSize - undo->textStart);
+	}
+	undo->writing = true;
+	undo->merge = false;
+	undo->minChanged = INT_MAX;
+	return true;
+}
+
+void undoBatchRun(undoBatch* batch) {
+	if (!batch || batch->failed) { return; }
+
+	// A new file starts with just the header
+	if (batch->path) {
+		struct iovec span = { UNDO_FILE_MAGIC, sizeof(UNDO_FILE_MAGIC) - 1 };
+		batch->fd = open(batch->path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+		batch->failed = (batch->fd < 0 || !fileWriteSpans(batch->fd, &span, 1));
+	}
+	if (batch->fd < 0 || batch->failed || lseek(batch->fd, batch->offset, SEEK_SET) < 0) {
+		batch->failed = true;
+		return;
+	}
+
+	// Write each op as a record followed by its text, a batch at a time
+	struct iovec spans[UNDO_MAX_SPANS];
+	undoRecord records[UNDO_MAX_SPANS / 2];
+	int numSpans = 0;
+	for(int i=0; i<batch->numOps && !batch->failed; ++i) {
+		undoOp* op = &batch->ops[i];
+		undoRecord* record = &records[numSpans / 2];
+		memset(record, 0, sizeof(*record));
+		record->type = UR_OP;
+		record->index = batch->first + i;
+		record->kind = op->kind;
+		record->row = op->row;
+		record->col = op->col;
+		record->cx = op->cx;
+		record->cy = op->cy;
+		record->len = op->len;
+		spans[numSpans].iov_base = record;
+		spans[numSpans++].iov_len = sizeof(*record);
+		spans[numSpans].iov_base = op->stored ? &batch->map[op->offset] : &batch->text[op->offset - batch->textStart];
+		spans[numSpans++].iov_len = op->len;
+		if (numSpans == UNDO_MAX_SPANS || i == batch->numOps - 1) {
+			batch->failed = !fileWriteSpans(batch->fd, spans, numSpans);
+			numSpans = 0;
+		}
+	}
+}
+
+void undoBatchClear(undoBatch* batch) {
+	if (!batch) { return; }
+
+	if (batch->map) { munmap(batch->map, batch->mapSize); }
+	if (batch->fd >= 0) { close(batch->fd); }
+	free(batch->path);
+	free(batch->ops);
+	free(batch->text);
+	memset(batch, 0, sizeof(*batch));
+	batch->fd = -1;
+}
+
+static void undoJournalStore(undoJournal* undo, undoBatch* batch) {
+	// Ops changed while the batch was being written stay in memory, and
+	// are written again with the next one
+	int end = MIN(MIN(batch->first + batch->numOps, undo->minChanged), undo->baseOp + undo->numOps) - undo->baseOp;
+	if (batch->path) {
+		undoJournalClose(undo);
+		undo->fd = batch->fd;
+		undo->path = batch->path;
+		batch->fd = -1;
+		batch->path = NULL;
+	}
+
+	// The text is read back from the file from now on
+	size_t offset = batch->offset;
+	for(int i=0; i<batch->numOps; ++i) {
+		int at = batch->first + i - undo->baseOp;
+		if (at >= undo->firstOp && at < end) {
+			undo->ops[at].offset = offset + sizeof(undoRecord);
+			undo->ops[at].stored = true;
+		}
+		offset += sizeof(undoRecord) + batch->ops[i].len;
+	}
+	undo->fileSize = offset;
+	undo->numStored = MAX(undo->numStored, end);
+	if (undo->numStored >= undo->numOps) {
+		undo->textStart = 0;
+		undo->textSize = 0;
+		if (undo->textCapacity > UNDO_BATCH_SIZE * 2) {
+			free(undo->text);
+			undo->text = NULL;
+			undo->textCapacity = 0;
+		}
+	} else {
+		undo->textStart = undo->ops[MAX(undo->numStored, undo->firstOp)].offset;
+	}
+	if (!undoJournalMap(undo)) {
+		// Without the mapping the text can't be read back, so the history goes
+		undoJournalClose(undo);
+		free(undo->ops);
+		free(undo->text);
+		undoJournalInit(undo, undo->limit);
+	}
+}
+
+void undoJournalFinish(undoJournal* undo, undoBatch* batch) {
+	if (!undo || !batch) { return; }
+
+	// A journal cleared in the meantime has nothing left to store the batch in.
+	// A file that's missing ops can't be read back, so nothing more goes in it
+	if (undo->writing) {
+		undo->writing = false;
+		if (batch->failed) {
+			undo->broken = true;
+		} else {
+			undoJournalStore(undo, batch);
+		}
+	}
+	undoBatchClear(batch);
+}
+
+bool undoJournalFlush(undoJournal* undo) {
+	if (!undo || undo->fd < 0 || undo->broken || undo->writing) { return false; }
+	if (undo->numStored >= undo->numOps) { return true; }
+
+	undoBatch batch;
+	if (!undoJournalCapture(undo, NULL, &batch)) { return false; }
+	undoBatchRun(&batch);
+	bool flushed = !batch.failed;
+	undoJournalFinish(undo, &batch);
+	return flushed && undo->fd >= 0;
+}
+
+static bool undoJournalReplay(undoJournal* undo, uint64_t hash, uint64_t size) {
+	// Find the last mark left by a save of exactly this text
+	size_t start = sizeof(UNDO_FILE_MAGIC) - 1;
+	size_t end = 0;
+	int current = 0;
+	undoRecord record;
+	for(size_t pos = start; pos + sizeof(record) <= undo->fileSize; ) {
+		memcpy(&record, &undo->map[pos], sizeof(record));
+		if (record.type != UR_OP && record.type != UR_MARK) { break; }
+		size_t next = pos + sizeof(record) + ((record.type == UR_OP) ? record.len : 0);
+		if (next < pos || next > undo->fileSize) { break; }
+		if (record.type == UR_MARK && record.hash == hash && record.len == size) {
+			end = next;
+			current = record.index;
+		}
+		pos = next;
+	}
+	if (end == 0) { return false; }
+
+	// Rebuild the ops leading up to it. Anything after it was never saved
+	bool valid = true;
+	for(size_t pos = start; pos < end && valid; ) {
+		memcpy(&record, &undo->map[pos], sizeof(record));
+		pos += sizeof(record);
+		if (record.type != UR_OP) { continue; }
+		valid = (record.index >= 0 && record.index <= undo->numOps && undoJournalReserveOps(undo, record.index + 1));
+		if (valid) {
+			undoOp* op = &undo->ops[record.index];
+			op->kind = record.kind;
+			op->row = record.row;
+			op->col = record.col;
+			op->cx = record.cx;
+			op->cy = record.cy;
+			op->offset = pos;
+			op->len = record.len;
+			op->stored = true;
+			undo->numOps = record.index + 1;
+		}
+		pos += record.len;
+	}
+	if (!valid || current < 0 || current > undo->numOps || ftruncate(undo->fd, end) != 0 || lseek(undo->fd, end, SEEK_SET) < 0) {
+		undo->numOps = 0;
+		return false;
+	}
+	undo->current = current;
+	undo->numStored = undo->numOps;
+	undo->fileSize = end;
+	return true;
+}
+
+bool undoJournalLoad(undoJournal* undo, const char* path, uint64_t hash, uint64_t size) {
+	if (!undo || !path) { return false; }
+
+	// Files without a journal get one the first time they're saved
+	undoJournalClear(undo);
+	if (!undoJournalOpen(undo, path, 0)) { return false; }
+	struct stat st;
+	size_t magicLen = sizeof(UNDO_FILE_MAGIC) - 1;
+	bool loaded = false;
+	if (fstat(undo->fd, &st) == 0 && (size_t)(st.st_size) > magicLen) {
+		undo->fileSize = st.st_size;
+		loaded = undoJournalMap(undo) && memcmp(undo->map, UNDO_FILE_MAGIC, magicLen) == 0 && undoJournalReplay(undo, hash, size);
+	}
+	if (!loaded) {
+		undoJournalClear(undo);
+		return false;
+	}
+	undoJournalTrim(undo);
+	return true;
+}
+
+int undoJournalCheckpoint(undoJournal* undo, const char* path, undoBatch* batch) {
+	if (!undo || !path || !batch) { return -1; }
+
+	// Saving under a new name starts a new journal file, with the whole history in it
+	bool restart = (!undo->path || undo->broken || strcmp(undo->path, path) != 0);
+	if (!undoJournalCapture(undo, restart ? path : NULL, batch)) { return -1; }
+	return undo->baseOp + undo->current;
+}
+
+void undoJournalMark(undoJournal* undo, int checkpoint, uint64_t hash, uint64_t size) {
+	if (!undo || checkpoint < 0 || undo->fd < 0 || undo->broken || undo->writing || undo->minChanged < checkpoint) { return; }
+
+	undoRecord record;
+	memset(&record, 0, sizeof(record));
+	record.type = UR_MARK;
+	record.index = checkpoint;
+	record.len = size;
+	record.hash = hash;
+	struct iovec span = { &record, sizeof(record) };
+	if (!fileWriteSpans(undo->fd, &span, 1)) {
+		undo->broken = true;
+		return;
+	}
+	undo->fileSize += sizeof(record);
+}
+
+static bool swapFileWrite(swapFile* swap, size_t keep) {
+	// The file is made with its first batch, and locked so other editors leave it alone
+	if (swap->fd < 0) {
+		swap->fd = open(swap->path, O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+		if (swap->fd < 0) { return false; }
+		if (flock(swap->fd, LOCK_EX | LOCK_NB) != 0 || ftruncate(swap->fd, keep) != 0 || lseek(swap->fd, 0, SEEK_END) < 0) {
+			close(swap->fd);
+			swap->fd = -1;
+			return false;
+		}
+	}
+
+	// The whole batch is synced at once, however many edits are in it
+	struct iovec span = { swap->batch.data, swap->batch.size };
+	return fileWriteSpans(swap->fd, &span, 1) && fdatasync(swap->fd) == 0;
+}
+
+static void* swapWriterRun(void* arg) {
+	swapWriter* writer = (swapWriter*)(arg);
+
+	pthread_mutex_lock(&writer->lock);
+	while(writer->pending || !writer->stop) {
+		if (!writer->pending) {
+			pthread_cond_wait(&writer->wake, &writer->lock);
+			continue;
+		}
+
+		// Give the edits after the first a moment to come in, so they're synced together
+		struct timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += writer->delay / 1000;
+		deadline.tv_nsec += (long)(writer->delay % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		while(!writer->urgent && !writer->stop && pthread_cond_timedwait(&writer->wake, &writer->lock, &deadline) != ETIMEDOUT) {}
+		writer->pending = false;
+		writer->urgent = false;
+		writer->busy = true;
+
+		// Files are only taken off the list here, so it can be walked with the lock let go
+		swapFile* prev = NULL;
+		swapFile* swap = writer->files;
+		while(swap) {
+			// Take the file's records, leaving it an empty buffer to fill
+			strbuf batch = swap->pending;
+			swap->pending = swap->batch;
+			swap->batch = batch;
+			bool reset = swap->reset;
+			bool closed = swap->closed;
+			bool discard = swap->discard;
+			bool failed = swap->failed;
+			size_t keep = swap->keep;
+			swap->reset = false;
+			if (reset) { swap->keep = 0; }
+			pthread_mutex_unlock(&writer->lock);
+
+			// Starting over removes the old file, and the next batch makes a new one
+			if (reset || discard) {
+				if (swap->fd >= 0 || keep > 0) { unlink(swap->path); }
+				if (swap->fd >= 0) { close(swap->fd); }
+				swap->fd = -1;
+				keep = 0;
+			}
+			if (swap->batch.size > 0 && !discard && !failed) {
+				failed = !swapFileWrite(swap, keep);
+			}
+			if (closed && swap->fd >= 0) {
+				close(swap->fd);
+				swap->fd = -1;
+			}
+			strbufDelete(&swap->batch, 0, -1);
+			if (swap->batch.capacity > SWAP_BUFFER_SIZE) {
+				strbufClear(&swap->batch);
+				strbufInit(&swap->batch, 64);
+			}
+
+			pthread_mutex_lock(&writer->lock);
+			swapFile* next = swap->next;
+			if (closed) {
+				if (prev) {
+					prev->next = next;
+				} else {
+					writer->files = next;
+				}
+				if (writer->filesTail == swap) { writer->filesTail = prev; }
+				strbufClear(&swap->pending);
+				strbufClear(&swap->batch);
+				free(swap->path);
+				free(swap);
+			} else {
+				// A file that's missing edits can't be replayed, so nothing more goes in it until it starts over
+				swap->failed |= (failed && !swap->reset);
+				prev = swap;
+			}
+			swap = next;
+		}
+		writer->busy = false;
+		writer->rounds++;
+		pthread_cond_broadcast(&writer->finished);
+	}
+	pthread_mutex_unlock(&writer->lock);
+	return NULL;
+}
+
+bool swapWriterInit(swapWriter* writer, int delay) {
+	if (!writer) { return false; }
+
+	// Waits are timed on the monotonic clock, so changing the time doesn't hold up writes
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_mutex_init(&writer->lock, NULL);
+	pthread_cond_init(&writer->wake, &attr);
+	pthread_cond_init(&writer->finished, NULL);
+	pthread_condattr_destroy(&attr);
+	writer->files = NULL;
+	writer->filesTail = NULL;
+	writer->delay = delay;
+	writer->rounds = 0;
+	writer->started = false;
+	writer->pending = false;
+	writer->urgent = false;
+	writer->busy = false;
+	writer->stop = false;
+	return true;
+}
+
+void swapWriterClear(swapWriter* writer) {
+	if (!writer) { return; }
+
+	// The thread writes whatever is pending before stopping
+	pthread_mutex_lock(&writer->lock);
+	writer->stop = true;
+	pthread_cond_signal(&writer->wake);
+	pthread_mutex_unlock(&writer->lock);
+	if (writer->started) {
+		pthread_join(writer->thread, NULL);
+		writer->started = false;
+	}
+
+	// Files still open belong to pages that were never closed, so they're left for recovery
+	while(writer->files) {
+		swapFile* swap = writer->files;
+		writer->files = swap->next;
+		if (swap->fd >= 0) { close(swap->fd); }
+		strbufClear(&swap->pending);
+		strbufClear(&swap->batch);
+		free(swap->path);
+		free(swap);
+	}
+	writer->filesTail = NULL;
+	pthread_cond_destroy(&writer->finished);
+	pthread_cond_destroy(&writer->wake);
+	pthread_mutex_destroy(&writer->lock);
+}
+
+swapFile* swapFileOpen(swapWriter* writer, const char* path, uint64_t hash, uint64_t size) {
+	if (!writer || !path) { return NULL; }
+
+	swapFile* swap = calloc(1, sizeof(*swap));
+	char* copy = swap ? strdup(path) : NULL;
+	if (!copy) {
+		free(swap);
+		return NULL;
+	}
+	swap->writer = writer;
+	swap->path = copy;
+	strbufInit(&swap->pending, 64);
+	strbufInit(&swap->batch, 64);
+	swap->fd = -1;
+	swap->hash = hash;
+	swap->size = size;
+
+	// Start the thread with the first file there is to write
+	pthread_mutex_lock(&writer->lock);
+	if (!writer->started) {
+		writer->started = (pthread_create(&writer->thread, NULL, swapWriterRun, writer) == 0);
+	}
+	if (!writer->started) {
+		pthread_mutex_unlock(&writer->lock);
+		strbufClear(&swap->pending);
+		strbufClear(&swap->batch);
+		free(swap->path);
+		free(swap);
+		return NULL;
+	}
+	if (writer->filesTail) {
+		writer->filesTail->next = swap;
+	} else {
+		writer->files = swap;
+	}
+	writer->filesTail = swap;
+	pthread_mutex_unlock(&writer->lock);
+	return swap;
+}
+
+static void swapWriterWake(swapWriter* writer) {
+	if (!writer->pending) {
+		writer->pending = true;
+		pthread_cond_signal(&writer->wake);
+	}
+}
+
+void swapFileClose(swapFile* swap, bool discard) {
+	if (!swap) { return; }
+
+	swapWriter* writer = swap->writer;
+	pthread_mutex_lock(&writer->lock);
+	swap->closed = true;
+	swap->discard = discard;
+	writer->urgent = true;
+	swapWriterWake(writer);
+
+	// Wait for a file that's being removed to be gone, so opening it again doesn't find it
+	if (discard && (swap->started || swap->keep > 0 || swap->reset)) {
+		uint64_t round = writer->rounds + (writer->busy ? 2 : 1);
+		while(writer->rounds < round) {
+			pthread_cond_wait(&writer->finished, &writer->lock);
+		}
+	}
+	pthread_mutex_unlock(&writer->lock);
+}
+
+static void swapFileAppend(swapFile* swap, const undoRecord* record, const char* text) {
+	// A new file starts with a mark for the file its edits apply to
+	if (!swap->started) {
+		undoRecord header;
+		memset(&header, 0, sizeof(header));
+		header.type = UR_MARK;
+		header.index = swap->index;
+		header.len = swap->size;
+		header.hash = swap->hash;
+		strbufAppend(&swap->pending, SWAP_FILE_MAGIC, sizeof(SWAP_FILE_MAGIC) - 1);
+		strbufAppend(&swap->pending, (const char*)(&header), sizeof(header));
+		swap->started = true;
+	}
+	strbufAppend(&swap->pending, (const char*)(record), sizeof(*record));
+	if (text) {
+		strbufAppend(&swap->pending, text, record->len);
+	}
+	swapWriterWake(swap->writer);
+}
+
+void swapFileRecord(swapFile* swap, int kind, int row, int col, const char* text, size_t len) {
+	if (!swap || !text || len == 0) { return; }
+
+	undoRecord record;
+	memset(&record, 0, sizeof(record));
+	record.type = UR_OP;
+	record.index = swap->index;
+	record.kind = kind;
+	record.row = row;
+	record.col = col;
+	record.len = len;
+
+	// Only a copy is made here; the writer does the rest
+	pthread_mutex_lock(&swap->writer->lock);
+	if (!swap->failed) {
+		swapFileAppend(swap, &record, text);
+	}
+	pthread_mutex_unlock(&swap->writer->lock);
+	swap->index++;
+}
+
+int swapFileCheckpoint(swapFile* swap) {
+	if (!swap) { return -1; }
+
+	return swap->index;
+}
+
+void swapFileMark(swapFile* swap, int checkpoint, uint64_t hash, uint64_t size) {
+	if (!swap || checkpoint < 0) { return; }
+
+	pthread_mutex_lock(&swap->writer->lock);
+	if (!swap->started) {
+		// Nothing was edited since the checkpoint, so the file can start from the save
+		swap->hash = hash;
+		swap->size = size;
+	} else if (!swap->failed) {
+		undoRecord record;
+		memset(&record, 0, sizeof(record));
+		record.type = UR_MARK;
+		record.index = checkpoint;
+		record.len = size;
+		record.hash = hash;
+		swapFileAppend(swap, &record, NULL);
+	}
+	pthread_mutex_unlock(&swap->writer->lock);
+}
+
+void swapFileReset(swapFile* swap, uint64_t hash, uint64_t size) {
+	if (!swap) { return; }
+
+	// Edits still waiting to be written are in the saved file, so they're dropped
+	pthread_mutex_lock(&swap->writer->lock);
+	strbufDelete(&swap->pending, 0, -1);
+	swap->reset = true;
+	swap->failed = false;
+	swap->started = false;
+	swap->hash = hash;
+	swap->size = size;
+	swapWriterWake(swap->writer);
+	pthread_mutex_unlock(&swap->writer->lock);
+}
+
+void swapFileResume(swapFile* swap, swapRecovery* recovery) {
+	if (!swap || !recovery) { return; }
+
+	// Whatever follows the last whole record is cut off when the file's next written
+	pthread_mutex_lock(&swap->writer->lock);
+	swap->keep = recovery->end;
+	swap->index = recovery->nextIndex;
+	swap->started = true;
+	pthread_mutex_unlock(&swap->writer->lock);
+}
+
+static const char* swapRecoveryNext(swapRecovery* recovery, size_t* pos, undoRecord* record) {
+	if (*pos + sizeof(*record) > recovery->end) { return NULL; }
+
+	memcpy(record, &recovery->map[*pos], sizeof(*record));
+	const char* text = &recovery->map[*pos + sizeof(*record)];
+	*pos += sizeof(*record) + ((record->type == UR_OP) ? record->len : 0);
+	return text;
+}
+
+bool swapRecoveryLoad(swapRecovery* recovery, const char* path, uint64_t hash, uint64_t size) {
+	if (!recovery || !path) { return false; }
+
+	memset(recovery, 0, sizeof(*recovery));
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) { return false; }
+
+	// A swap file that's still locked belongs to an editor that's still running
+	if (flock(fd, LOCK_SH | LOCK_NB) != 0) {
+		recovery->locked = (errno == EWOULDBLOCK);
+		close(fd);
+		return false;
+	}
+	struct stat st;
+	size_t magicLen = sizeof(SWAP_FILE_MAGIC) - 1;
+	if (fstat(fd, &st) == 0 && (size_t)(st.st_size) > magicLen) {
+		void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			recovery->map = map;
+			recovery->mapSize = st.st_size;
+		}
+	}
+	close(fd);
+	recovery->path = strdup(path);
+	if (!recovery->map || !recovery->path || memcmp(recovery->map, SWAP_FILE_MAGIC, magicLen) != 0) {
+		swapRecoveryClear(recovery);
+		return false;
+	}
+
+	// Find the last save of the file as it is now. A record cut short was
+	// never synced, so it and anything after it are ignored
+	bool found = false;
+	undoRecord record;
+	recovery->end = magicLen;
+	for(size_t pos = magicLen; pos + sizeof(record) <= recovery->mapSize; ) {
+		memcpy(&record, &recovery->map[pos], sizeof(record));
+		if (record.type != UR_OP && record.type != UR_MARK) { break; }
+		size_t next = pos + sizeof(record) + ((record.type == UR_OP) ? record.len : 0);
+		if (next < pos || next > recovery->mapSize || record.index < 0) { break; }
+		if (record.type == UR_MARK && record.hash == hash && record.len == size) {
+			recovery->first = record.index;
+			found = true;
+		}
+		recovery->nextIndex = MAX(recovery->nextIndex, record.index + ((record.type == UR_OP) ? 1 : 0));
+		recovery->end = pos = next;
+	}
+
+	// Edits made while that save was being written come before its mark, so they're picked out by index
+	size_t pos = magicLen;
+	while(found && swapRecoveryNext(recovery, &pos, &record)) {
+		recovery->numOps += (record.type == UR_OP && record.index >= recovery->first) ? 1 : 0;
+	}
+	if (recovery->numOps == 0) {
+		swapRecoveryClear(recovery);
+		return false;
+	}
+	return true;
+}
+
+void swapRecoveryClear(swapRecovery* recovery) {
+	if (!recovery) { return; }
+
+	if (recovery->map) { munmap(recovery->map, recovery->mapSize); }
+	free(recovery->path);
+	recovery->map = NULL;
+	recovery->mapSize = 0;
+	recovery->path = NULL;
+}
+
+void rowInit(editorRow* row) {
+	if (!row) { return; }
+
+	// Rows start out empty and don't allocate until they need more than one piece
+	memset(row, 0, sizeof(*row));
+	row->dirty = false;
+}
+
+void rowClear(editorRow* row) {
+	if (!row) { return; }
+
+	if (row->maxPieces > 0) {
+		free(row->pieces);
+	}
+	strbufClear(&row->text);
+	strbufClear(&row->rtext);
+	free(row->tabs);
+	row->pieces = NULL;
+	row->numPieces = 0;
+	row->maxPieces = 0;
+	row->tabs = NULL;
+	row->numTabs = 0;
+	row->maxTabs = 0;
+	row->tabsValid = false;
+	row->size = 0;
+}
+
+void rowUpdate(editorContext* ctx, editorRow* row) {
+	if (!row || !row->dirty) { return; }
+
+	// Clear render buffer
+	strbufDelete(&row->rtext, 0, -1);
+
+	// Render text
+	textPiece* pieces = rowGetPieces(row);
+	for(int i=0; i<row->numPieces; ++i) {
+		for(unsigned int j=0; j<pieces[i].len; ++j) {
+			char c = pieces[i].data[j];
+			if (c == '\t') {
+				strbufAddChar(&row->rtext, ' ');
+				while(row->rtext.size % ctx->settingTabStop != 0) { 
+					strbufAddChar(&row->rtext, ' '); 
+				}
+			} else {
+				strbufAddChar(&row->rtext, c);
+			}
+		}
+	}
+	row->dirty = false;
+}
+
+static bool rowIndexTabs(editorContext* ctx, editorRow* row) {
+	if (row->tabsValid) { return true; }
+
+	// Record every tab, along with where the text after it is rendered
+	row->numTabs = 0;
+	unsigned int base = 0;
+	unsigned int lastCx = 0;
+	unsigned int lastRx = 0;
+	textPiece* pieces = rowGetPieces(row);
+	for(int p=0; p<row->numPieces; ++p) {
+		const char* data = pieces[p].data;
+		const char* end = data + pieces[p].len;
+		for(const char* tab = memchr(data, '\t', end - data); tab; tab = memchr(tab + 1, '\t', end - (tab + 1))) {
+			if (row->numTabs >= row->maxTabs) {
+				int newSize = (row->maxTabs == 0) ? 4 : (row->maxTabs * 2);
+				rowTab* newTabs = realloc(row->tabs, newSize * sizeof(*newTabs));
+				if (!newTabs) { return false; }
+				row->tabs = newTabs;
+				row->maxTabs = newSize;
+			}
+			unsigned int cx = base + (tab - data);
+			unsigned int rx = lastRx + (cx - lastCx);
+			rowTab* entry = &row->tabs[row->numTabs++];
+			entry->cx = cx;
+			entry->rx = ((rx / ctx->settingTabStop) + 1) * ctx->settingTabStop;
+			lastCx = cx + 1;
+			lastRx = entry->rx;
+		}
+		base += pieces[p].len;
+	}
+	row->tabsValid = true;
+	return true;
+}
+
+int rowCxToRx(editorContext* ctx, editorRow* row, int cx) {
+	if (!ctx || !row || cx <= 0) { return 0; }
+	if (!rowIndexTabs(ctx, row)) { return cx; }
+
+	// Count the tabs before the cursor
+	int lo = 0;
+	int hi = row->numTabs;
+	while(lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (row->tabs[mid].cx < (unsigned int)cx) { lo = mid + 1; }
+		else { hi = mid; }
+	}
+	if (lo == 0) { return cx; }
+	rowTab* tab = &row->tabs[lo - 1];
+	return tab->rx + (cx - tab->cx - 1);
+}
+
+int rowRxToCx(editorContext* ctx, editorRow* row, int rx) {
+	if (!ctx || !row || rx <= 0) { return 0; }
+	if (!rowIndexTabs(ctx, row)) { return MIN((unsigned int)rx, row->size); }
+
+	// Count the tabs rendered entirely before the position
+	int lo = 0;
+	int hi = row->numTabs;
+	while(lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (row->tabs[mid].rx <= (unsigned int)rx) { lo = mid + 1; }
+		else { hi = mid; }
+	}
+
+	// Positions covered by the next tab land on it
+	unsigned int lastCx = (lo > 0) ? row->tabs[lo - 1].cx + 1 : 0;
+	unsigned int lastRx = (lo > 0) ? row->tabs[lo - 1].rx : 0;
+	if (lo < row->numTabs && (unsigned int)rx >= lastRx + (row->tabs[lo].cx - lastCx)) {
+		return row->tabs[lo].cx;
+	}
+	return MIN(lastCx + (rx - lastRx), row->size);
+}
+
+textPiece* rowGetPieces(editorRow* row) {
+	if (!row) { return NULL; }
+	return (row->maxPieces > 0) ? row->pieces : &row->piece;
+}
+
+char rowGetChar(editorRow* row, int at) {
+	if (!row || row->size == 0) { return '\0'; }
+
+	if (at < 0) { 
+		at = row->size - 1; 
+	}
+	if ((unsigned int)(at) >= row->size) { 
+		return '\0'; 
+	}
+	textPiece* pieces = rowGetPieces(row);
+	for(int i=0; i<row->numPieces; ++i) {
+		if ((unsigned int)(at) < pieces[i].len) { return pieces[i].data[at]; }
+		at -= pieces[i].len;
+	}
+	return '\0';
+}
+
+void rowRead(editorRow* row, strbuf* buf, unsigned int at, int len) {
+	if (!row || !buf || at >= row->size) { return; }
+
+	// Check boundaries
+	if (len < 0 || at + len > row->size) {
+		len = row->size - at;
+	}
+
+	// Copy each overlapping piece
+	textPiece* pieces = rowGetPieces(row);
+	for(int i=0; i<row->numPieces && len > 0; ++i) {
+		if (at >= pieces[i].len) {
+			at -= pieces[i].len;
+			continue;
+		}
+		unsigned int count = MIN(pieces[i].len - at, (unsigned int)len);
+		strbufAppend(buf, &pieces[i].data[at], count);
+		len -= count;
+		at = 0;
+	}
+}
+
+static void rowReservePieces(editorRow* row, int num) {
+	if (num <= 1 && row->maxPieces == 0) { return; }
+	if (num <= row->maxPieces) { return; }
+
+	// Move the inline piece out to the heap the first time the row needs more than one
+	int newCapacity = MAX(4, row->maxPieces * 2);
+	while(newCapacity < num) { newCapacity *= 2; }
+	textPiece* newPieces = NULL;
+	if (row->maxPieces == 0) {
+		newPieces = malloc(newCapacity * sizeof(*newPieces));
+		if (!newPieces) { return; }
+		if (row->numPieces > 0) { newPieces[0] = row->piece; }
+	} else {
+		newPieces = realloc(row->pieces, newCapacity * sizeof(*newPieces));
+		if (!newPieces) { return; }
+	}
+	row->pieces = newPieces;
+	row->maxPieces = newCapacity;
+}
+
+static void rowInsertPieces(editorRow* row, unsigned int at, const textPiece* src, int num) {
+	if (num <= 0) { return; }
+
+	// Find the piece containing the insertion point
+	textPiece* pieces = rowGetPieces(row);
+	int idx = 0;
+	while(idx < row->numPieces && at >= pieces[idx].len) {
+		at -= pieces[idx].len;
+		idx++;
+	}
+
+	// Make room, splitting the piece if inserting into its middle
+	bool split = (idx < row->numPieces && at > 0);
+	int extra = num + (split ? 1 : 0);
+	rowReservePieces(row, row->numPieces + extra);
+	pieces = rowGetPieces(row);
+	if (row->numPieces + extra > MAX(1, row->maxPieces)) { return; }
+	if (idx < row->numPieces) {
+		memmove(&pieces[idx + extra], &pieces[idx], (row->numPieces - idx) * sizeof(*pieces));
+	}
+	if (split) {
+		pieces[idx] = pieces[idx + extra];
+		pieces[idx].len = at;
+		pieces[idx + extra].data += at;
+		pieces[idx + extra].len -= at;
+		idx++;
+	}
+
+	// Copy in new pieces
+	for(int i=0; i<num; ++i) {
+		pieces[idx + i] = src[i];
+		row->size += src[i].len;
+	}
+	row->numPieces += extra;
+}
+
+static void rowSyncSpans(editorRow* row) {
+	// Point the row's pieces at the text on either side of the gap
+	textPiece spans[2];
+	strbufGetSpans(&row->text, spans);
+	row->numPieces = 0;
+	for(int i=0; i<2; ++i) {
+		if (spans[i].len > 0) { row->pieces[row->numPieces++] = spans[i]; }
+	}
+	row->size = row->text.size;
+}
+
+static bool rowMakeEditable(editorRow* row) {
+	if (row->text.data) { return true; }
+
+	// Copy the row's pieces into a gap buffer the first time it is edited in place
+	rowReservePieces(row, 2);
+	if (row->maxPieces < 2) { return false; }
+	strbufInit(&row->text, row->size + 1);
+	if (!row->text.data) { return false; }
+	rowRead(row, &row->text, 0, -1);
+	rowSyncSpans(row);
+	return true;
+}
+
+void rowInsert(editorRow* row, int at, const char* str, unsigned int len) {
+	if (!row || !str || len == 0) { return; }
+
+	// Check boundaries
+	unsigned int pos = 0;
+	if (at < 0 || (unsigned int)at > row->size) { 
+		pos = row->size;
+	} else {
+		pos = (unsigned int)at;
+	}
+	if (!rowMakeEditable(row)) { return; }
+	strbufGapInsert(&row->text, str, len, pos);
+	rowSyncSpans(row);
+	row->tabsValid = false;
+	row->dirty = true;
+}
+
+void rowCopy(editorRow* row, int at, editorRow* src, unsigned int srcAt, int len) {
+	if (!row || !src || srcAt >= src->size || len == 0) { return; }
+
+	// Check boundaries
+	unsigned int pos = 0;
+	if (at < 0 || (unsigned int)at > row->size) { 
+		pos = row->size;
+	} else {
+		pos = (unsigned int)at;
+	}
+	if (len < 0 || srcAt + len > src->size) {
+		len = src->size - srcAt;
+	}
+
+	// Collect the source pieces overlapping the range
+	textPiece* srcPieces = rowGetPieces(src);
+	textPiece* slice = malloc(src->numPieces * sizeof(*slice));
+	if (!slice) { return; }
+	int num = 0;
+	for(int i=0; i<src->numPieces && len > 0; ++i) {
+		if (srcAt >= srcPieces[i].len) {
+			srcAt -= srcPieces[i].len;
+			continue;
+		}
+		unsigned int count = MIN(srcPieces[i].len - srcAt, (unsigned int)len);
+		slice[num].data = &srcPieces[i].data[srcAt];
+		slice[num].len = count;
+		num++;
+		len -= count;
+		srcAt = 0;
+	}
+
+	// Text owned by a row's gap buffer can't be shared, so it is copied instead
+	if (row->text.data || src->text.data) {
+		if (rowMakeEditable(row)) {
+			for(int i=0; i<num; ++i) {
+				strbufGapInsert(&row->text, slice[i].data, slice[i].len, pos);
+				pos += slice[i].len;
+			}
+			rowSyncSpans(row);
+		}
+	} else {
+		rowInsertPieces(row, pos, slice, num);
+	}
+	free(slice);
+	row->tabsValid = false;
+	row->dirty = true;
+}
+
+void rowDelete(editorRow* row, int at, int len) {
+	if (!row || row->size == 0 || len == 0) { return; }
+
+	// Check boundaries
+	unsigned int pos = 0;
+	if (at < 0 || (unsigned int)at >= row->size) { 
+		pos = row->size - 1;
+	} else {
+		pos = (unsigned int)at;
+	}
+	if (len < 0 || pos + len > row->size) {
+		len = row->size - pos;
+	}
+	if (!rowMakeEditable(row)) { return; }
+	strbufGapDelete(&row->text, pos, len);
+	rowSyncSpans(row);
+	row->tabsValid = false;
+	row->dirty = true;
+}
+
+void pageInit(editorPage* page) {
+	if (!page) { return; }
+
+	page->rows = NULL;
+	pieceTableInit(&page->text);
+	page->huge = NULL;
+	page->filename = NULL;
+	page->fullFilename = NULL;
+	page->numRows = 0;
+	page->cx = 0;
+	page->cy = 0;
+	page->rx = 0;
+	page->ry = 0;
+	page->rowOff = 0;
+	page->colOff = 0;
+	page->tabStop = NEO_TAB_STOP;
+	page->flags = 0;
+	page->job = NULL;
+	page->snapshot = 0;
+	page->retired = NULL;
+	undoJournalInit(&page->undo, UNDO_MAX_SIZE);
+
+	// New pages are the same as an empty file, as far as their swap files are concerned
+	contentHash hash;
+	contentHashInit(&hash);
+	page->savedHash = contentHashFinal(&hash);
+	page->savedSize = 0;
+	page->swap = NULL;
+	page->recovery = NULL;
+}
+
+/// @brief Epoch new row nodes are stamped with. Taking a snapshot moves it on,
+/// @brief so every node made before the snapshot can be told apart from later ones.
+static uint64_t rowNodeEpoch = 1;
+
+static rowNode* rowNodeCreate(bool leaf) {
+	rowNode* node = malloc(sizeof(*node));
+	if (!node) { return NULL; }
+
+	node->epoch = __atomic_load_n(&rowNodeEpoch, __ATOMIC_RELAXED);
+	node->prev = NULL;
+	node->next = NULL;
+	node->numRows = 0;
+	node->maxWidth = 0;
+	node->numChildren = 0;
+	node->leaf = leaf;
+	return node;
+}
+
+static void rowNodeFree(rowNode* node) {
+	if (!node) { return; }
+
+	for(int i=0; i<node->numChildren; ++i) {
+		if (node->leaf) {
+			rowClear(&node->rows[i]);
+		} else {
+			rowNodeFree(node->children[i]);
+		}
+	}
+	free(node);
+}
+
+static bool rowNodeFrozen(editorPage* page, rowNode* node) {
+	return page->snapshot != 0 && node->epoch <= page->snapshot;
+}
+
+static void rowNodeRelease(editorPage* page, rowNode* node) {
+	if (!node) { return; }
+
+	// Nodes still in the snapshot are kept until it's released
+	if (rowNodeFrozen(page, node)) {
+		for(int i=0; !node->leaf && i<node->numChildren; ++i) {
+			rowNodeRelease(page, node->children[i]);
+		}
+		node->next = page->retired;
+		page->retired = node;
+		return;
 	}
-	row->dirty = false;
+	for(int i=0; i<node->numChildren; ++i) {
+		if (node->leaf) {
+			rowClear(&node->rows[i]);
+		} else {
+			rowNodeRelease(page, node->children[i]);
+		}
+	}
+	free(node);
+}
+
+static bool rowDuplicate(editorRow* dest, editorRow* src) {
+	// Text is copied so the two rows can be edited separately, but the render
+	// state is only a cache, and is rebuilt for the copy
+	*dest = *src;
+	memset(&dest->rtext, 0, sizeof(dest->rtext));
+	dest->tabs = NULL;
+	dest->numTabs = 0;
+	dest->maxTabs = 0;
+	dest->tabsValid = false;
+	dest->dirty = true;
+	if (src->maxPieces > 0) {
+		dest->pieces = malloc(src->maxPieces * sizeof(*dest->pieces));
+		if (!dest->pieces) { return false; }
+		memcpy(dest->pieces, src->pieces, src->numPieces * sizeof(*dest->pieces));
+	}
+	if (src->text.data) {
+		dest->text.data = malloc(src->text.capacity);
+		if (!dest->text.data) {
+			free(dest->pieces);
+			return false;
+		}
+		memcpy(dest->text.data, src->text.data, src->text.capacity);
+		rowSyncSpans(dest);
+	}
+	return true;
+}
+
+static rowNode* rowNodeOwn(editorPage* page, rowNode** slot) {
+	rowNode* node = *slot;
+	if (!rowNodeFrozen(page, node)) { return node; }
+
+	// Copy the node into the current epoch, leaving the original to the snapshot
+	rowNode* copy = rowNodeCreate(node->leaf);
+	if (!copy) { return NULL; }
+	copy->numRows = node->numRows;
+	copy->maxWidth = node->maxWidth;
+	copy->numChildren = node->numChildren;
+	if (node->leaf) {
+		for(int i=0; i<node->numChildren; ++i) {
+			if (!rowDuplicate(&copy->rows[i], &node->rows[i])) {
+				for(int j=0; j<i; ++j) {
+					rowClear(&copy->rows[j]);
+				}
+				free(copy);
+				return NULL;
+			}
+		}
+		copy->prev = node->prev;
+		copy->next = node->next;
+		if (copy->prev) { copy->prev->next = copy; }
+		if (copy->next) { copy->next->prev = copy; }
+	} else {
+		memcpy(copy->children, node->children, node->numChildren * sizeof(*node->children));
+	}
+	node->next = page->retired;
+	page->retired = node;
+	*slot = copy;
+	return copy;
+}
+
+static uint64_t pageTakeSnapshot(editorPage* page) {
+	// Every node that exists now belongs to the snapshot as well as the page
+	page->snapshot = __atomic_fetch_add(&rowNodeEpoch, 1, __ATOMIC_RELAXED);
+	return page->snapshot;
+}
+
+static void pageReleaseSnapshot(editorPage* page) {
+	// Free the nodes that only the snapshot was still using
+	page->snapshot = 0;
+	while(page->retired) {
+		rowNode* node = page->retired;
+		page->retired = node->next;
+		for(int i=0; node->leaf && i<node->numChildren; ++i) {
+			rowClear(&node->rows[i]);
+		}
+		free(node);
+	}
+}
+
+static int rowNodeCapacity(rowNode* node) {
+	return node->leaf ? ROW_BLOCK_SIZE : ROW_TREE_ORDER;
+}
+
+static void rowNodeUpdateWidth(rowNode* node) {
+	node->maxWidth = 0;
+	for(int i=0; i<node->numChildren; ++i) {
+		unsigned int width = node->leaf ? node->rows[i].width : node->children[i]->maxWidth;
+		node->maxWidth = MAX(node->maxWidth, width);
+	}
+}
+
+static int rowNodeFindChild(rowNode* node, int* at, bool inserting) {
+	// Rows on the boundary between two children go at the end of the left one when inserting
+	int i = 0;
+	for(; i<node->numChildren - 1; ++i) {
+		int num = node->children[i]->numRows;
+		if (*at < num || (inserting && *at == num)) { break; }
+		*at -= num;
+	}
+	return i;
+}
+
+static rowNode* pageOwnPath(editorPage* page, int* at) {
+	// Copy every shared node on the way down to the leaf holding the row
+	rowNode** slot = &page->rows;
+	while(1) {
+		rowNode* node = rowNodeOwn(page, slot);
+		if (!node || node->leaf) { return node; }
+		slot = &node->children[rowNodeFindChild(node, at, false)];
+	}
+}
+
+static rowNode* rowNodeSplit(rowNode* node, int keep) {
+	rowNode* sibling = rowNodeCreate(node->leaf);
+	if (!sibling) { return NULL; }
+
+	// Move everything past the first `keep` entries to the new sibling
+	int moved = node->numChildren - keep;
+	if (node->leaf) {
+		memcpy(sibling->rows, &node->rows[keep], moved * sizeof(*node->rows));
+		sibling->numRows = moved;
+		sibling->prev = node;
+		sibling->next = node->next;
+		if (node->next) { node->next->prev = sibling; }
+		node->next = sibling;
+	} else {
+		memcpy(sibling->children, &node->children[keep], moved * sizeof(*node->children));
+		for(int i=0; i<moved; ++i) {
+			sibling->numRows += sibling->children[i]->numRows;
+		}
+	}
+	sibling->numChildren = moved;
+	node->numChildren = keep;
+	node->numRows -= sibling->numRows;
+	rowNodeUpdateWidth(node);
+	rowNodeUpdateWidth(sibling);
+	return sibling;
+}
+
+static void rowNodeUnlink(rowNode* node) {
+	// Take every leaf under the node out of the leaf chain
+	if (!node->leaf) {
+		for(int i=0; i<node->numChildren; ++i) {
+			rowNodeUnlink(node->children[i]);
+		}
+		return;
+	}
+	if (node->prev) { node->prev->next = node->next; }
+	if (node->next) { node->next->prev = node->prev; }
+}
+
+static void rowNodeRemoveChild(editorPage* page, rowNode* node, int idx) {
+	rowNode* child = node->children[idx];
+	rowNodeUnlink(child);
+	node->numRows -= child->numRows;
+	rowNodeRelease(page, child);
+	memmove(&node->children[idx], &node->children[idx + 1], (node->numChildren - idx - 1) * sizeof(*node->children));
+	node->numChildren--;
+}
+
+static void rowNodeMerge(editorPage* page, rowNode* node, int idx) {
+	// Move the contents of child idx + 1 onto the end of child idx
+	rowNode* left = rowNodeOwn(page, &node->children[idx]);
+	rowNode* right = left ? rowNodeOwn(page, &node->children[idx + 1]) : NULL;
+	if (!right) { return; }
+	if (left->leaf) {
+		memcpy(&left->rows[left->numChildren], right->rows, right->numChildren * sizeof(*right->rows));
+	} else {
+		memcpy(&left->children[left->numChildren], right->children, right->numChildren * sizeof(*right->children));
+	}
+	left->numChildren += right->numChildren;
+	left->numRows += right->numRows;
+	left->maxWidth = MAX(left->maxWidth, right->maxWidth);
+	right->numChildren = 0;
+	right->numRows = 0;
+	rowNodeRemoveChild(page, node, idx + 1);
+}
+
+static void rowNodeRebalance(editorPage* page, rowNode* node, int idx) {
+	rowNode* child = node->children[idx];
+	int capacity = rowNodeCapacity(child);
+
+	// Drop empty children and fold underfull ones into a neighbour when they fit
+	if (child->numRows == 0 && node->numChildren > 1) {
+		rowNodeRemoveChild(page, node, idx);
+	} else if (child->numChildren < capacity / 2) {
+		if (idx > 0 && node->children[idx - 1]->numChildren + child->numChildren <= capacity) {
+			rowNodeMerge(page, node, idx - 1);
+		} else if (idx < node->numChildren - 1 && node->children[idx + 1]->numChildren + child->numChildren <= capacity) {
+			rowNodeMerge(page, node, idx);
+		}
+	}
+}
+
+void pageClear(editorPage* page) {
+	if (!page) { return; }
+
+	hugeFileClose(page->huge);
+	rowNodeRelease(page, page->rows);
+	pageReleaseSnapshot(page);
+	undoJournalClear(&page->undo);
+	free(page->filename);
+	free(page->fullFilename);
+	pieceTableClear(&page->text);
+	page->rows = NULL;
+	page->huge = NULL;
+
+	// Unsaved edits are left in the swap file, for when the page wasn't closed on purpose
+	swapFileClose(page->swap, PAGE_FLAG_ISCLEAR(page, EF_DIRTY));
+	swapRecoveryClear(page->recovery);
+	free(page->recovery);
+	page->swap = NULL;
+	page->recovery = NULL;
+}
+
+static unsigned int rowMeasure(editorRow* row, int tabStop) {
+	// Rows only render wider than their length when they have tabs
+	unsigned int width = 0;
+	textPiece* pieces = rowGetPieces(row);
+	for(int i=0; i<row->numPieces; ++i) {
+		const char* text = pieces[i].data;
+		const char* end = text + pieces[i].len;
+		for(const char* tab; (tab = memchr(text, '\t', end - text)); text = tab + 1) {
+			width += tab - text;
+			width = ((width / tabStop) + 1) * tabStop;
+		}
+		width += end - text;
+	}
+	return width;
+}
+
+static void pageSetRowWidth(editorPage* page, int at, unsigned int width) {
+	// Walk down to the row, then refresh the widest row on the way back up
+	rowNode* path[32];
+	int depth = 0;
+	rowNode* node = page->rows;
+	while(!node->leaf) {
+		path[depth++] = node;
+		node = node->children[rowNodeFindChild(node, &at, false)];
+	}
+	node->rows[at].width = width;
+	rowNodeUpdateWidth(node);
+	for(int i=depth - 1; i>=0; --i) {
+		rowNodeUpdateWidth(path[i]);
+	}
+}
+
+static void pageMeasureRow(editorPage* page, int at) {
+	// Measure an edited row straight away, since it may be nowhere near the screen
+	editorRow* row = pageGetRow(page, at);
+	if (!row) { return; }
+	unsigned int width = rowMeasure(row, page->tabStop);
+	if (row->width != width) {
+		pageSetRowWidth(page, at, width);
+	}
+}
+
+static void pageSlideWindow(editorContext* ctx, editorPage* page) {
+	// Only move the window once the cursor gets near an edge that isn't the end of the file
+	hugeFile* huge = page->huge;
+	int margin = HUGE_WINDOW_ROWS / 4;
+	bool nearTop = (page->cy < margin && huge->windowLine > 0);
+	bool nearBottom = (page->cy >= page->numRows - margin && huge->windowEnd < huge->fileSize);
+	if (!nearTop && !nearBottom) { return; }
+
+	// Recentre the window on the cursor, keeping the view in the same place
+	int64_t cursor = huge->windowLine + page->cy;
+	int64_t rowOff = huge->windowLine + page->rowOff;
+	if (!pageLoadWindow(ctx, page, MAX(0, cursor - HUGE_WINDOW_ROWS / 2))) { return; }
+	page->cy = (int)MIN(cursor - huge->windowLine, (int64_t)page->numRows - 1);
+	page->rowOff = (int)MAX(0, rowOff - huge->windowLine);
+}
+
+void pageUpdate(editorContext* ctx, editorPage* page) {
+	if (!page) { return; }
+
+	if (page->huge) {
+		pageSlideWindow(ctx, page);
+	}
+	int first = MAX(0, page->rowOff - NEO_RENDER_MARGIN);
+	int last = page->rowOff + ctx->screenRows + NEO_RENDER_MARGIN;
+	rowIter it;
+	editorRow* row = pageSeekRow(page, first, &it);
+	for(int i=first; row && i<last; ++i, row = rowIterNext(&it)) {
+		rowUpdate(ctx, row); 
+		if (row->width != row->rtext.size) {
+			pageSetRowWidth(page, i, row->rtext.size);
+		}
+	}
+}
+
+int pageGetNumCols(editorPage* page) {
+	return (page && page->rows) ? (int)page->rows->maxWidth : 0;
+}
+
+editorRow* pageGetRow(editorPage* page, int at) {
+	rowIter it;
+	return pageSeekRow(page, at, &it);
+}
+
+editorRow* pageEditRow(editorPage* page, int at) {
+	if (!page || !page->rows || at < 0 || at >= page->numRows) { return NULL; }
+
+	rowNode* leaf = pageOwnPath(page, &at);
+	return leaf ? &leaf->rows[at] : NULL;
+}
+
+editorRow* pageSeekRow(editorPage* page, int at, rowIter* it) {
+	if (!it) { return NULL; }
+	it->leaf = NULL;
+	if (!page || !page->rows || at < 0 || at >= page->numRows) { return NULL; }
+
+	// Walk down the tree to the leaf holding the row
+	rowNode* node = page->rows;
+	while(!node->leaf) {
+		node = node->children[rowNodeFindChild(node, &at, false)];
+	}
+	it->leaf = node;
+	it->index = at;
+	return &node->rows[at];
+}
+
+editorRow* rowIterNext(rowIter* it) {
+	if (!it || !it->leaf) { return NULL; }
+
+	it->index++;
+	while(it->leaf && it->index >= it->leaf->numChildren) {
+		it->leaf = it->leaf->next;
+		it->index = 0;
+	}
+	return it->leaf ? &it->leaf->rows[it->index] : NULL;
+}
+
+static editorRow* pageInsertRowSlot(editorPage* page, int at) {
+	// Grow the tree upwards if the root is full
+	if (!page->rows) {
+		page->rows = rowNodeCreate(true);
+		if (!page->rows) { return NULL; }
+	}
+	if (page->rows->numChildren >= rowNodeCapacity(page->rows)) {
+		rowNode* root = rowNodeCreate(false);
+		if (!root) { return NULL; }
+		root->children[0] = page->rows;
+		root->numChildren = 1;
+		root->numRows = page->rows->numRows;
+		root->maxWidth = page->rows->maxWidth;
+		page->rows = root;
+	}
+
+	// Walk down to the leaf, splitting full nodes on the way so there is always room
+	rowNode* path[32];
+	int depth = 0;
+	rowNode* node = rowNodeOwn(page, &page->rows);
+	if (!node) { return NULL; }
+	while(!node->leaf) {
+		int idx = rowNodeFindChild(node, &at, true);
+		rowNode* child = rowNodeOwn(page, &node->children[idx]);
+		if (!child) { return NULL; }
+		if (child->numChildren >= rowNodeCapacity(child)) {
+			// Appending to a full leaf leaves it full instead of splitting it in half
+			bool append = child->leaf && at == child->numChildren;
+			rowNode* sibling = rowNodeSplit(child, append ? child->numChildren : child->numChildren / 2);
+			if (!sibling) { return NULL; }
+			memmove(&node->children[idx + 2], &node->children[idx + 1], (node->numChildren - idx - 1) * sizeof(*node->children));
+			node->children[idx + 1] = sibling;
+			node->numChildren++;
+			if (at > child->numRows || (append && at == child->numRows)) {
+				at -= child->numRows;
+				child = sibling;
+			}
+		}
+		path[depth++] = node;
+		node = child;
+	}
+
+	// Shift rows down within the leaf
+	if (at < node->numChildren) {
+		memmove(&node->rows[at + 1], &node->rows[at], (node->numChildren - at) * sizeof(*node->rows));
+	}
+	node->numChildren++;
+	node->numRows++;
+	for(int i=0; i<depth; ++i) { 
+		path[i]->numRows++; 
+	}
+	return &node->rows[at];
+}
+
+static void rowNodeReleaseBranches(editorPage* page, rowNode* node) {
+	if (!node || node->leaf) { return; }
+
+	for(int i=0; i<node->numChildren; ++i) {
+		rowNodeReleaseBranches(page, node->children[i]);
+	}
+	if (rowNodeFrozen(page, node)) {
+		node->next = page->retired;
+		page->retired = node;
+	} else {
+		free(node);
+	}
+}
+
+static rowNode** rowTreeReserve(size_t numLeaves, size_t* numBranches) {
+	// Count the branches a tree over the leaves needs, at most
+	size_t num = 0;
+	for(size_t level = numLeaves; level > 1; ) {
+		level = (level + ROW_TREE_ORDER - 1) / ROW_TREE_ORDER;
+		num += level;
+	}
+
+	// Allocate them all at once, so linking the tree can't fail halfway
+	rowNode** branches = malloc(MAX((size_t)(1), num) * sizeof(*branches));
+	if (!branches) { return NULL; }
+	for(size_t i=0; i<num; ++i) {
+		branches[i] = rowNodeCreate(false);
+		if (!branches[i]) {
+			for(size_t j=0; j<i; ++j) { free(branches[j]); }
+			free(branches);
+			return NULL;
+		}
+	}
+	*numBranches = num;
+	return branches;
+}
+
+static void rowTreeRelease(rowNode** branches, size_t num) {
+	// Free the branches the tree didn't use
+	for(size_t i=0; i<num; ++i) {
+		free(branches[i]);
+	}
+	free(branches);
+}
+
+static rowNode* rowTreeLink(rowNode** nodes, size_t num, rowNode** branches) {
+	// Group each level into parents, spreading children evenly, until one node is left
+	while(num > 1) {
+		size_t numParents = (num + ROW_TREE_ORDER - 1) / ROW_TREE_ORDER;
+		size_t next = 0;
+		for(size_t p=0; p<numParents; ++p) {
+			size_t count = (num - next) / (numParents - p);
+			rowNode* parent = *branches;
+			*branches++ = NULL;
+			for(size_t i=0; i<count; ++i) {
+				rowNode* child = nodes[next++];
+				parent->children[parent->numChildren++] = child;
+				parent->numRows += child->numRows;
+				parent->maxWidth = MAX(parent->maxWidth, child->maxWidth);
+			}
+			nodes[p] = parent;
+		}
+		num = numParents;
+	}
+	return (num == 1) ? nodes[0] : NULL;
+}
+
+static rowNode* rowTreeBuild(rowNode** nodes, size_t num) {
+	size_t numBranches = 0;
+	rowNode** branches = rowTreeReserve(num, &numBranches);
+	if (!branches) {
+		for(size_t i=0; i<num; ++i) { rowNodeFree(nodes[i]); }
+		return NULL;
+	}
+	rowNode* root = rowTreeLink(nodes, num, branches);
+	rowTreeRelease(branches, numBranches);
+	return root;
+}
+
+static bool pageSpliceRows(editorPage* page, int at, editorRow* rows, int num) {
+	// Find the leaf to split, and count the leaves that will be in the new tree
+	int leafAt = MIN(at, page->numRows - 1);
+	if (!pageOwnPath(page, &leafAt)) { return false; }
+	rowNode* first = page->rows;
+	while(!first->leaf) {
+		first = first->children[0];
+	}
+	size_t numLeaves = 1 + ((num + ROW_BLOCK_SIZE - 1) / ROW_BLOCK_SIZE);
+	rowNode* leaf = NULL;
+	int idx = 0;
+	for(rowNode* node = first; node; node = node->next) {
+		if (!leaf && (at < node->numChildren || (at == node->numChildren && !node->next))) {
+			leaf = node;
+			idx = at;
+		}
+		at -= leaf ? 0 : node->numChildren;
+		numLeaves++;
+	}
+
+	// Allocate everything up front, so failing leaves the tree as it was
+	rowNode** nodes = malloc(numLeaves * sizeof(*nodes));
+	size_t numNew = 0;
+	bool failed = !nodes;
+	for(int i=0; !failed && i<num; i+=ROW_BLOCK_SIZE) {
+		nodes[numNew] = rowNodeCreate(true);
+		failed = !nodes[numNew++];
+	}
+	size_t numBranches = 0;
+	rowNode** branches = failed ? NULL : rowTreeReserve(numLeaves, &numBranches);
+	failed = !branches;
+	rowNode* right = NULL;
+	if (!failed && idx < leaf->numChildren) {
+		right = rowNodeSplit(leaf, idx);
+		failed = !right;
+	}
+	if (failed) {
+		for(size_t i=0; nodes && i<numNew; ++i) {
+			free(nodes[i]);
+		}
+		if (branches) { rowTreeRelease(branches, numBranches); }
+		free(nodes);
+		return false;
+	}
+
+	// Fill the new leaves and chain them in after the split leaf
+	rowNode* prev = leaf;
+	rowNode* next = leaf->next;
+	for(size_t i=0; i<numNew; ++i) {
+		rowNode* node = nodes[i];
+		node->numChildren = MIN(ROW_BLOCK_SIZE, num - (int)(i * ROW_BLOCK_SIZE));
+		node->numRows = node->numChildren;
+		memcpy(node->rows, &rows[i * ROW_BLOCK_SIZE], node->numChildren * sizeof(*node->rows));
+		rowNodeUpdateWidth(node);
+		node->prev = prev;
+		prev->next = node;
+		prev = node;
+	}
+	prev->next = next;
+	if (next) { next->prev = prev; }
+
+	// Rebuild the branches over the leaves, dropping the split leaf if it was emptied
+	rowNodeReleaseBranches(page, page->rows);
+	size_t count = 0;
+	for(rowNode* node = first; node; ) {
+		rowNode* following = node->next;
+		if (node->numChildren == 0) {
+			if (node->prev) { node->prev->next = following; }
+			if (following) { following->prev = node->prev; }
+			rowNodeRelease(page, node);
+		} else {
+			nodes[count++] = node;
+		}
+		node = following;
+	}
+	page->rows = rowTreeLink(nodes, count, branches);
+	rowTreeRelease(branches, numBranches);
+	free(nodes);
+	return true;
+}
+
+static bool pageInsertRows(editorPage* page, int at, editorRow* rows, int num) {
+	if (!page->rows) {
+		page->rows = rowNodeCreate(true);
+		if (!page->rows) { return false; }
+	}
+
+	// A few rows go in one at a time; a block of them is spliced in between
+	// leaves, and the branches rebuilt once
+	if (num >= ROW_BLOCK_SIZE) {
+		if (!pageSpliceRows(page, at, rows, num)) {
+			for(int i=0; i<num; ++i) {
+				rowClear(&rows[i]);
+			}
+			return false;
+		}
+	} else {
+		for(int i=0; i<num; ++i) {
+			editorRow* row = pageInsertRowSlot(page, at + i);
+			if (!row) {
+				// Take back the rows already in, so nothing is half inserted
+				page->numRows += i;
+				for(int j=0; j<i; ++j) {
+					pageDeleteRow(page, at);
+				}
+				for(int j=i; j<num; ++j) {
+					rowClear(&rows[j]);
+				}
+				return false;
+			}
+			memcpy(row, &rows[i], sizeof(*row));
+			if (row->width > 0) {
+				pageSetRowWidth(page, at + i, row->width);
+			}
+		}
+	}
+	page->numRows += num;
+	PAGE_FLAG_SET(page, EF_DIRTY);
+	return true;
+}
+
+editorRow* pageInsertRow(editorPage* page, int at, char* str, unsigned int len) {
+	if (!page) { return NULL; }
+	
+	// Check boundaries
+	if (at < 0 || at > page->numRows) { 
+		at = page->numRows; 
+	}
+	editorRow* row = pageInsertRowSlot(page, at);
+	if (!row) { return NULL; }
+
+	// Copy text into the piece table
+	rowInit(row);
+	if (str && len > 0) {
+		row->piece.data = pieceTableAppend(&page->text, str, len);
+		row->piece.len = row->piece.data ? len : 0;
+		row->numPieces = row->piece.len ? 1 : 0;
+		row->size = row->piece.len;
+		pageSetRowWidth(page, at, rowMeasure(row, page->tabStop));
+	}
+	row->dirty = true;
+
+	// Update state
+	page->numRows++;
+	if (PAGE_FLAG_ISCLEAR(page, EF_READONLY)) {
+		PAGE_FLAG_SET(page, EF_DIRTY);
+	}
+	return row;
+}
+
+static bool pageInsertTextFailed(editorPage* page, bool added, bool dirty) {
+	// A row added for the text goes again, so the page is left as it was
+	if (added) {
+		pageDeleteRow(page, page->numRows - 1);
+		if (!dirty) { PAGE_FLAG_CLEAR(page, EF_DIRTY); }
+	}
+	return false;
+}
+
+bool pageInsertText(editorPage* page, const char* text, unsigned int len) {
+	if (!page || !text || len == 0 || PAGE_FLAG_ISSET(page, EF_READONLY)) { return false; }
+
+	// Copy the text into the piece table once; new rows point straight into it
+	bool added = (page->cy >= page->numRows);
+	bool dirty = PAGE_FLAG_ISSET(page, EF_DIRTY);
+	editorRow* currRow = added ? pageInsertRow(page, -1, "", 0) : pageEditRow(page, page->cy);
+	if (!currRow) { return false; }
+	const char* data = pieceTableAppend(&page->text, text, len);
+	if (!data) { return pageInsertTextFailed(page, added, dirty); }
+	int numLines = 0;
+	for(const char* p = data; (p = memchr(p, '\n', data + len - p)); ++p) {
+		numLines++;
+	}
+	if (numLines == 0) {
+		unsigned int size = currRow->size;
+		rowInsert(currRow, page->cx, data, len);
+		if (currRow->size != size + len) { return pageInsertTextFailed(page, added, dirty); }
+		pageMeasureRow(page, page->cy);
+		page->cx += len;
+		PAGE_FLAG_SET(page, EF_DIRTY);
+		return true;
+	}
+
+	// Build the rows after the first line before touching the page
+	editorRow* rows = malloc(numLines * sizeof(*rows));
+	if (!rows) { return pageInsertTextFailed(page, added, dirty); }
+	const char* first = memchr(data, '\n', len);
+	const char* line = first + 1;
+	for(int i=0; i<numLines; ++i) {
+		const char* end = (i < numLines - 1) ? memchr(line, '\n', data + len - line) : data + len;
+		rowInit(&rows[i]);
+		rows[i].piece.data = line;
+		rows[i].piece.len = end - line;
+		rows[i].numPieces = rows[i].piece.len ? 1 : 0;
+		rows[i].size = rows[i].piece.len;
+		rows[i].width = rowMeasure(&rows[i], page->tabStop);
+		rows[i].dirty = true;
+		line = end + 1;
+	}
+	editorRow* last = &rows[numLines - 1];
+	unsigned int lastLen = last->size;
+
+	// The text after the cursor moves to the end of the last line, which is
+	// copied before anything changes so a failure leaves the page as it was
+	unsigned int tailLen = ((unsigned int)page->cx < currRow->size) ? currRow->size - page->cx : 0;
+	if (tailLen > 0) {
+		rowCopy(last, -1, currRow, page->cx, -1);
+		last->width = rowMeasure(last, page->tabStop);
+	}
+	bool inserted = (last->size == lastLen + tailLen) && rowMakeEditable(currRow);
+	if (inserted) {
+		// Make room for the first line up front too, so adding it can't fail
+		unsigned int needed = currRow->size + (first - data) + 1;
+		strbufGrow(&currRow->text, needed);
+		rowSyncSpans(currRow);
+		inserted = (currRow->text.capacity >= needed);
+	}
+	if (!inserted) {
+		for(int i=0; i<numLines; ++i) {
+			rowClear(&rows[i]);
+		}
+	} else {
+		inserted = pageInsertRows(page, page->cy + 1, rows, numLines);
+	}
+	free(rows);
+	if (!inserted) { return pageInsertTextFailed(page, added, dirty); }
+
+	// Inserting rows may have moved the current one
+	currRow = pageEditRow(page, page->cy);
+	if (!currRow) { return false; }
+	if (tailLen > 0) {
+		rowDelete(currRow, page->cx, -1);
+	}
+	rowInsert(currRow, page->cx, data, first - data);
+	pageMeasureRow(page, page->cy);
+	pageSetCursorRow(page, page->cy + numLines);
+	pageSetCursorCol(page, lastLen);
+	return true;
+}
+
+void pageDeleteRow(editorPage* page, int at) {
+	if (!page || !page->rows || page->numRows == 0) { return; }
+
+	// Check boundaries
+	if (at < 0 || at >= page->numRows) { 
+		at = page->numRows - 1;
+	}
+
+	// Walk down to the leaf holding the row, once anything shared along the way has been copied
+	int leafAt = at;
+	if (!pageOwnPath(page, &leafAt)) { return; }
+	rowNode* path[32];
+	int pathIdx[32];
+	int depth = 0;
+	rowNode* node = page->rows;
+	while(!node->leaf) {
+		int idx = rowNodeFindChild(node, &at, false);
+		path[depth] = node;
+		pathIdx[depth++] = idx;
+		node->numRows--;
+		node = node->children[idx];
+	}
+
+	// Shift rows up within the leaf
+	rowClear(&node->rows[at]);
+	memmove(&node->rows[at], &node->rows[at + 1], (node->numChildren - at - 1) * sizeof(*node->rows));
+	node->numChildren--;
+	node->numRows--;
+	rowNodeUpdateWidth(node);
+
+	// Rebalance on the way back up, then drop roots with a single child
+	for(int i=depth - 1; i>=0; --i) {
+		rowNodeRebalance(page, path[i], pathIdx[i]);
+		rowNodeUpdateWidth(path[i]);
+	}
+	while(!page->rows->leaf && page->rows->numChildren == 1) {
+		rowNode* root = page->rows;
+		page->rows = root->children[0];
+		root->numChildren = 0;
+		rowNodeRelease(page, root);
+	}
+	
+	// Update state
+	page->numRows--;
+	if (PAGE_FLAG_ISCLEAR(page, EF_READONLY)) {
+		PAGE_FLAG_SET(page, EF_DIRTY);
+	}
+}
+
+static bool pageDeleteRows(editorPage* page, int at, int num) {
+	// A few rows are deleted one at a time; a block of them is cut out of the
+	// leaves, and the branches rebuilt once
+	if (num < ROW_BLOCK_SIZE) {
+		for(int i=0; i<num; ++i) {
+			pageDeleteRow(page, at);
+		}
+		return true;
+	}
+
+	// Find the leaves at both ends of the block, and count the leaves in the tree
+	int firstAt = at;
+	int lastAt = at + num - 1;
+	rowNode* first = pageOwnPath(page, &firstAt);
+	rowNode* last = first ? pageOwnPath(page, &lastAt) : NULL;
+	if (!last) { return false; }
+	rowNode* head = page->rows;
+	while(!head->leaf) {
+		head = head->children[0];
+	}
+	size_t numLeaves = 0;
+	for(rowNode* node = head; node; node = node->next) {
+		numLeaves++;
+	}
+	rowNode** nodes = malloc(numLeaves * sizeof(*nodes));
+	size_t numBranches = 0;
+	rowNode** branches = nodes ? rowTreeReserve(numLeaves, &numBranches) : NULL;
+	if (!branches) {
+		free(nodes);
+		return false;
+	}
+
+	// Cut the rows from the leaves at each end, and drop the leaves in between
+	rowNodeReleaseBranches(page, page->rows);
+	if (first == last) {
+		for(int i=firstAt; i<=lastAt; ++i) {
+			rowClear(&first->rows[i]);
+		}
+		memmove(&first->rows[firstAt], &first->rows[lastAt + 1], (first->numChildren - lastAt - 1) * sizeof(*first->rows));
+		first->numChildren -= num;
+	} else {
+		for(int i=firstAt; i<first->numChildren; ++i) {
+			rowClear(&first->rows[i]);
+		}
+		first->numChildren = firstAt;
+		for(int i=0; i<=lastAt; ++i) {
+			rowClear(&last->rows[i]);
+		}
+		memmove(&last->rows[0], &last->rows[lastAt + 1], (last->numChildren - lastAt - 1) * sizeof(*last->rows));
+		last->numChildren -= lastAt + 1;
+		for(rowNode* node = first->next; node != last; ) {
+			rowNode* following = node->next;
+			rowNodeRelease(page, node);
+			node = following;
+		}
+		first->next = last;
+		last->prev = first;
+	}
+	first->numRows = first->numChildren;
+	last->numRows = last->numChildren;
+	rowNodeUpdateWidth(first);
+	rowNodeUpdateWidth(last);
+
+	// Rebuild the branches over the leaves that are left
+	size_t count = 0;
+	for(rowNode* node = head; node; ) {
+		rowNode* following = node->next;
+		if (node->numChildren == 0) {
+			if (node->prev) { node->prev->next = following; }
+			if (following) { following->prev = node->prev; }
+			rowNodeRelease(page, node);
+		} else {
+			nodes[count++] = node;
+		}
+		node = following;
+	}
+	page->rows = rowTreeLink(nodes, count, branches);
+	rowTreeRelease(branches, numBranches);
+	free(nodes);
+	page->numRows -= num;
+	PAGE_FLAG_SET(page, EF_DIRTY);
+	return true;
+}
+
+static bool pageDeleteText(editorPage* page, int row, int col, const char* text, size_t len) {
+	// The text ends on the row after its last newline
+	int numLines = 0;
+	const char* lastLine = text;
+	for(const char* p = text; (p = memchr(p, '\n', text + len - p)); ++p) {
+		numLines++;
+		lastLine = p + 1;
+	}
+	if (row + numLines >= page->numRows) { return false; }
+	editorRow* currRow = pageEditRow(page, row);
+	if (!currRow) { return false; }
+	if (numLines == 0) {
+		rowDelete(currRow, col, len);
+	} else {
+		// Whatever follows the text on its last row moves onto the first
+		editorRow* lastRow = pageGetRow(page, row + numLines);
+		if (col < (int)currRow->size) {
+			rowDelete(currRow, col, -1);
+		}
+		rowCopy(currRow, -1, lastRow, text + len - lastLine, -1);
+		if (!pageDeleteRows(page, row + 1, numLines)) { return false; }
+	}
+	pageMeasureRow(page, row);
+	PAGE_FLAG_SET(page, EF_DIRTY);
+	pageSetCursorRow(page, row);
+	pageSetCursorCol(page, col);
+	return true;
+}
+
+static bool pageReplayEdit(editorPage* page, int kind, int row, int col, const char* text, size_t len) {
+	if (kind == UK_DELETE) {
+		return pageDeleteText(page, row, col, text, len);
+	}
+	page->cy = row;
+	page->cx = col;
+	return pageInsertText(page, text, len);
+}
+
+static bool pageApplyEdit(editorPage* page, int kind, const undoOp* op) {
+	const char* text = undoJournalText(&page->undo, op);
+	if (!pageReplayEdit(page, kind, op->row, op->col, text, op->len)) { return false; }
+	swapFileRecord(page->swap, kind, op->row, op->col, text, op->len);
+	return true;
+}
+
+bool pageUndo(editorPage* page) {
+	if (!page || PAGE_FLAG_ISSET(page, EF_READONLY)) { return false; }
+
+	// Inserted text is deleted again, and deleted text put back
+	const undoOp* op = undoJournalUndo(&page->undo);
+	if (!op) { return false; }
+	if (!pageApplyEdit(page, (op->kind == UK_INSERT) ? UK_DELETE : UK_INSERT, op)) {
+		undoJournalClear(&page->undo);
+		return false;
+	}
+	pageSetCursorRow(page, op->cy);
+	pageSetCursorCol(page, op->cx);
+	return true;
 }
 
-int rowCxToRx(editorContext* ctx, editorRow* row, int cx) {
-	if (!ctx || !row) { return 0; }
+bool pageRedo(editorPage* page) {
+	if (!page || PAGE_FLAG_ISSET(page, EF_READONLY)) { return false; }
 
-	int rx = 0;
-	for(int i=0; i<cx; ++i) {
-		if (strbufGetChar(&row->text, i) == '\t') { 
-			rx += (ctx->settingTabStop - 1) - (rx % ctx->settingTabStop); 
-		}
-		rx++;
+	const undoOp* op = undoJournalRedo(&page->undo);
+	if (!op) { return false; }
+	if (!pageApplyEdit(page, op->kind, op)) {
+		undoJournalClear(&page->undo);
+		return false;
 	}
-	return rx;
+	return true;
 }
 
-void rowInsert(editorRow* row, int at, const char* str, unsigned int len) {
-	if (!row) { return; }
+static void pageRecordEdit(editorPage* page, int kind, int row, int col, const char* text, size_t len, int cx, int cy) {
+	undoJournalRecord(&page->undo, kind, row, col, text, len, cx, cy);
+	swapFileRecord(page->swap, kind, row, col, text, len);
+}
 
-	// Check boundaries
-	unsigned int pos = 0;
-	if (at < 0 || (unsigned int)at > row->text.size) { 
-		pos = row->text.size;
-	} else {
-		pos = (unsigned int)at;
+static void pageRecordNewRow(editorPage* page, int row, int cx, int cy) {
+	// A row added past the end is the same as a newline after the one before it
+	editorRow* prevRow = pageGetRow(page, row);
+	if (prevRow) {
+		pageRecordEdit(page, UK_INSERT, row, prevRow->size, "\n", 1, cx, cy);
 	}
-	strbufInsert(&row->text, str, len, pos);
-	row->dirty = true;
 }
 
-void rowDelete(editorRow* row, int at, int len) {
-	if (!row) { return; }
-
-	// Check boundaries
-	unsigned int pos = 0;
-	if (at < 0 || (unsigned int)at >= row->text.size) { 
-		pos = row->text.size - 1;
-	} else {
-		pos = (unsigned int)at;
+static int pageReplaySwap(editorPage* page, swapRecovery* recovery) {
+	// Recovered edits can be undone like any other, but they're already in the swap file
+	int numReplayed = 0;
+	undoRecord record;
+	size_t pos = sizeof(SWAP_FILE_MAGIC) - 1;
+	for(const char* text; (text = swapRecoveryNext(recovery, &pos, &record)); ) {
+		if (record.type != UR_OP || record.index < recovery->first) { continue; }
+		editorRow* row = pageGetRow(page, record.row);
+		bool valid = (record.kind == UK_INSERT || record.kind == UK_DELETE) && record.col >= 0;
+		valid &= row ? ((unsigned int)(record.col) <= row->size) : (record.kind == UK_INSERT && record.row == page->numRows && record.col == 0);
+		if (!valid || !pageReplayEdit(page, record.kind, record.row, record.col, text, record.len)) { break; }
+		undoJournalRecord(&page->undo, record.kind, record.row, record.col, text, record.len, record.col, record.row);
+		numReplayed++;
 	}
-	strbufDelete(&row->text, pos, len);
-	row->dirty = true;
+	return numReplayed;
 }
 
-void pageInit(editorPage* page) {
-	if (!page) { return; }
+/// @brief Part of a file being split into rows by one loader thread.
+typedef struct {
+	const char* start;
+	const char* end;
+	fptrLineScanner scan;
+	int tabStop;
+	rowNode* first;
+	rowNode* last;
+	int numLeaves;
+	int numRows;
+	size_t numCRLF;
+	size_t numLF;
+	bool failed;
+} loadChunk;
+
+static bool loadChunkAddRow(loadChunk* chunk, const char* line, const char* end, bool newline) {
+	// Trim the carriage return of a CRLF, counting which line ending was used
+	size_t len = end - line;
+	if (newline) {
+		if (len > 0 && line[len - 1] == '\r') {
+			chunk->numCRLF++;
+			len--;
+		} else {
+			chunk->numLF++;
+		}
+	}
 
-	page->rows = malloc(0);
-	page->filename = NULL;
-	page->fullFilename = NULL;
-	page->maxRows = 0;
-	page->numRows = 0;
-	page->numCols = 0;
-	page->cx = 0;
-	page->cy = 0;
-	page->rx = 0;
-	page->ry = 0;
-	page->rowOff = 0;
-	page->colOff = 0;
-	page->flags = 0;
-}
+	// Start a new block once the current one is full
+	rowNode* leaf = chunk->last;
+	if (!leaf || leaf->numChildren >= ROW_BLOCK_SIZE) {
+		rowNode* next = rowNodeCreate(true);
+		if (!next) { return false; }
+		next->prev = leaf;
+		if (leaf) { leaf->next = next; }
+		else { chunk->first = next; }
+		chunk->last = next;
+		chunk->numLeaves++;
+		leaf = next;
+	}
 
-void pageClear(editorPage* page) {
-	if (!page) { return; }
+	// Point the row into the original buffer
+	editorRow* row = &leaf->rows[leaf->numChildren++];
+	rowInit(row);
+	row->piece.data = line;
+	row->piece.len = len;
+	row->numPieces = (len > 0) ? 1 : 0;
+	row->size = len;
+	row->dirty = true;
 
-	for(int i=0; i<page->numRows; ++i) { 
-		rowClear(&page->rows[i]); 
+	// Measure how wide the row renders, which is only more than its length with tabs
+	row->width = len;
+	const char* tab = memchr(line, '\t', len);
+	if (tab) {
+		row->width = tab - line;
+		for(; tab < line + len; ++tab) {
+			row->width = (*tab == '\t') ? ((row->width / chunk->tabStop) + 1) * chunk->tabStop : (row->width + 1);
+		}
 	}
-	free(page->filename);
-	free(page->fullFilename);
-	free(page->rows);
+	leaf->maxWidth = MAX(leaf->maxWidth, row->width);
+	leaf->numRows++;
+	chunk->numRows++;
+	return true;
 }
 
-void pageUpdate(editorContext* ctx, editorPage* page) {
-	if (!page) { return; }
-
-	for(int i=0; i<page->numRows; ++i) {
-		editorRow* row = &page->rows[i]; 
-		rowUpdate(ctx, row); 
-		page->numCols = MAX(page->numCols, (int)row->rtext.size);
+static void loadChunkKeepReturns(loadChunk* chunk) {
+	// Put back the carriage returns trimmed off the rows that had them, so a file
+	// with mixed line endings is saved the way it was
+	for(rowNode* leaf = chunk->first; leaf; leaf = (leaf == chunk->last) ? NULL : leaf->next) {
+		for(int i=0; i<leaf->numChildren; ++i) {
+			editorRow* row = &leaf->rows[i];
+			const char* after = row->piece.data + row->piece.len;
+			if (after >= chunk->end || *after != '\r') { continue; }
+			row->piece.len++;
+			row->numPieces = 1;
+			row->size++;
+			row->width++;
+			leaf->maxWidth = MAX(leaf->maxWidth, row->width);
+		}
 	}
 }
 
-void pageGrowRows(editorPage* page) {
-	if (!page) { return; }
+static void* loadChunkRun(void* data) {
+	loadChunk* chunk = (loadChunk*)(data);
+	uint32_t* newlines = malloc(LOAD_SCAN_BLOCK * sizeof(*newlines));
+	if (!newlines) {
+		chunk->failed = true;
+		return NULL;
+	}
+
+	// Scan the chunk a block at a time, adding a row for every newline found
+	const char* line = chunk->start;
+	for(const char* block = chunk->start; block < chunk->end && !chunk->failed; block += LOAD_SCAN_BLOCK) {
+		size_t len = MIN((size_t)(chunk->end - block), (size_t)LOAD_SCAN_BLOCK);
+		size_t num = chunk->scan(block, len, newlines);
+		for(size_t i=0; i<num && !chunk->failed; ++i) {
+			const char* newline = &block[newlines[i]];
+			chunk->failed = !loadChunkAddRow(chunk, line, newline, true);
+			line = newline + 1;
+		}
+	}
 
-	int newSize = (page->maxRows == 0) ? 48 : (page->maxRows * 2);
-	editorRow* newRows = realloc(page->rows, newSize * sizeof(*newRows));
-	if (!newRows) { return; }
-	for(int i=page->numRows; i<newSize; ++i) { 
-		rowInit(&newRows[i]); 
+	// Last line of the file may not end in a newline
+	if (line < chunk->end && !chunk->failed) {
+		chunk->failed = !loadChunkAddRow(chunk, line, chunk->end, false);
 	}
-	page->rows = newRows;
-	page->maxRows = newSize;
+	free(newlines);
+	return NULL;
 }
 
-editorRow* pageInsertRow(editorPage* page, int at, char* str, unsigned int len) {
-	if (!page) { return NULL; }
-	
-	// Check boundaries
-	if (at < 0 || at > page->numRows) { 
-		at = page->numRows; 
+bool pageLoad(editorContext* ctx, editorPage* page, FILE* fp) {
+	if (!ctx || !page || !fp || page->rows) { return false; }
+
+	// Files this big are paged in a window at a time instead
+	struct stat st;
+	if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= HUGE_FILE_MIN_SIZE) {
+		int fd = dup(fileno(fp));
+		if (fd < 0 || !(page->huge = hugeFileOpen(fd, st.st_size))) { return false; }
+		PAGE_FLAG_SET(page, EF_READONLY);
+		return pageLoadWindow(ctx, page, 0);
 	}
 
-	// Resize if necessary
-	if (page->numRows >= page->maxRows) { 
-		pageGrowRows(page); 
+	// Load file contents into the piece table
+	if (!pieceTableLoad(&page->text, fp)) { return false; }
+	const char* data = page->text.original;
+	size_t size = page->text.originalSize;
+	if (size == 0) { return true; }
+
+	// Split the file into one chunk per thread, each starting at the beginning of a line
+	long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int numChunks = (int)MAX(1L, MIN(MIN((long)LOAD_MAX_THREADS, numCpus), (long)(size / LOAD_CHUNK_MIN_SIZE)));
+	loadChunk chunks[LOAD_MAX_THREADS];
+	memset(chunks, 0, sizeof(chunks));
+	fptrLineScanner scan = lineScannerGet();
+	const char* start = data;
+	const char* end = data + size;
+	int num = 0;
+	for(int i=0; i<numChunks && start < end; ++i) {
+		const char* stop = (i == numChunks - 1) ? end : MAX(start, data + (size / numChunks) * (i + 1));
+		if (stop < end) {
+			const char* newline = memchr(stop, '\n', end - stop);
+			stop = newline ? newline + 1 : end;
+		}
+		chunks[num].start = start;
+		chunks[num].end = stop;
+		chunks[num].scan = scan;
+		chunks[num].tabStop = ctx->settingTabStop;
+		num++;
+		start = stop;
+	}
+
+	// Index every chunk in parallel, with this thread taking the first one
+	pthread_t threads[LOAD_MAX_THREADS];
+	bool started[LOAD_MAX_THREADS] = { false };
+	for(int i=1; i<num; ++i) {
+		started[i] = (pthread_create(&threads[i], NULL, loadChunkRun, &chunks[i]) == 0);
+	}
+	loadChunkRun(&chunks[0]);
+	for(int i=1; i<num; ++i) {
+		if (started[i]) { pthread_join(threads[i], NULL); }
+		else { loadChunkRun(&chunks[i]); }
 	}
 
-	// Shift rows down
-	if (at < page->numRows) {
-		memmove(&page->rows[at + 1], &page->rows[at], (page->numRows - at) * sizeof(*page->rows));
+	// Stitch the runs of blocks together in order
+	size_t numLeaves = 0;
+	bool failed = false;
+	for(int i=0; i<num; ++i) {
+		numLeaves += chunks[i].numLeaves;
+		failed |= chunks[i].failed;
+	}
+	rowNode** nodes = failed ? NULL : malloc(numLeaves * sizeof(*nodes));
+	if (!nodes) {
+		for(int i=0; i<num; ++i) {
+			for(rowNode* leaf = chunks[i].first; leaf; ) {
+				rowNode* next = leaf->next;
+				rowNodeFree(leaf);
+				leaf = next;
+			}
+		}
+		return false;
+	}
+	size_t count = 0;
+	size_t numCRLF = 0;
+	size_t numLF = 0;
+	rowNode* last = NULL;
+	for(int i=0; i<num; ++i) {
+		if (last && chunks[i].first) {
+			last->next = chunks[i].first;
+			chunks[i].first->prev = last;
+		}
+		for(rowNode* leaf = chunks[i].first; leaf; leaf = (leaf == chunks[i].last) ? NULL : leaf->next) {
+			nodes[count++] = leaf;
+		}
+		last = chunks[i].last ? chunks[i].last : last;
+		page->numRows += chunks[i].numRows;
+		numCRLF += chunks[i].numCRLF;
+		numLF += chunks[i].numLF;
 	}
 
-	// Copy text buffer to row
-	editorRow* row = &page->rows[at];
-	strbufDelete(&row->text, 0, -1);
-	strbufSet(&row->text, str, len, 0);
-	row->dirty = true;
+	// Only files ending every line in CRLF are saved that way
+	if (numCRLF > 0 && numLF > 0) {
+		for(int i=0; i<num; ++i) {
+			loadChunkKeepReturns(&chunks[i]);
+		}
+	}
 
-	// Update state
-	page->numRows++;
-	if (PAGE_FLAG_ISCLEAR(page, EF_READONLY)) {
-		PAGE_FLAG_SET(page, EF_DIRTY);
+	// Build the branches of the row tree on top of the blocks
+	page->rows = rowTreeBuild(nodes, count);
+	free(nodes);
+	if (!page->rows) {
+		page->numRows = 0;
+		return false;
 	}
-	return row;
+	if (numCRLF > 0 && numLF == 0) {
+		PAGE_FLAG_SET(page, EF_CRLF);
+	}
+	return true;
 }
 
-void pageDeleteRow(editorPage* page, int at) {
-	if (!page) { return; }
+bool pageLoadWindow(editorContext* ctx, editorPage* page, int64_t line) {
+	if (!ctx || !page || !page->huge) { return false; }
+	hugeFile* huge = page->huge;
+
+	// Read from the start of the line until the window is full
+	int64_t start = 0;
+	if (!hugeFileFindLine(huge, line, &start)) { return false; }
+	char* data = NULL;
+	size_t size = 0;
+	size_t capacity = 0;
+	size_t used = 0;
+	int numLines = 0;
+	bool eof = false;
+	while(numLines < HUGE_WINDOW_ROWS && size < HUGE_WINDOW_MAX_SIZE) {
+		if (size == capacity) {
+			capacity = MIN((capacity == 0) ? (size_t)LOAD_SCAN_BLOCK : (capacity * 2), (size_t)HUGE_WINDOW_MAX_SIZE);
+			char* newData = realloc(data, capacity);
+			if (!newData) {
+				free(data);
+				return false;
+			}
+			data = newData;
+		}
+		ssize_t len = pread(huge->fd, &data[size], capacity - size, start + size);
+		if (len < 0) {
+			free(data);
+			return false;
+		}
+		if (len == 0) {
+			eof = true;
+			break;
+		}
 
-	// Check boundaries
-	if (at < 0 || at >= page->numRows) { 
-		at = page->numRows - 1;
+		// Count the lines read, remembering where the last whole one ends
+		const char* end = &data[size + len];
+		const char* newline = NULL;
+		for(const char* pos = &data[size]; numLines < HUGE_WINDOW_ROWS && (newline = memchr(pos, '\n', end - pos)); pos = newline + 1) {
+			numLines++;
+			used = (newline + 1) - data;
+		}
+		size += len;
 	}
 
-	// Shift rows up
-	if (at < page->numRows - 1) {
-		memmove(&page->rows[at], &page->rows[at + 1], (page->numRows - at - 1) * sizeof(*page->rows));
+	// Keep a trailing partial line at the end of the file, or one too long to fit
+	if (eof || numLines == 0) {
+		used = size;
 	}
-	
-	// Update state
-	page->numRows--;
-	if (PAGE_FLAG_ISCLEAR(page, EF_READONLY)) {
-		PAGE_FLAG_SET(page, EF_DIRTY);
+
+	// Split the window into rows
+	loadChunk chunk;
+	memset(&chunk, 0, sizeof(chunk));
+	chunk.start = data;
+	chunk.end = data + used;
+	chunk.scan = lineScannerGet();
+	chunk.tabStop = ctx->settingTabStop;
+	if (used > 0) {
+		loadChunkRun(&chunk);
+	}
+	if (!chunk.failed && chunk.numCRLF > 0 && chunk.numLF > 0) {
+		loadChunkKeepReturns(&chunk);
+	}
+	rowNode** nodes = chunk.failed ? NULL : malloc(MAX(1, chunk.numLeaves) * sizeof(*nodes));
+	size_t count = 0;
+	for(rowNode* leaf = chunk.first; leaf; ) {
+		rowNode* next = leaf->next;
+		if (nodes) { nodes[count++] = leaf; }
+		else { rowNodeFree(leaf); }
+		leaf = next;
+	}
+	if (!nodes) {
+		free(data);
+		return false;
+	}
+	rowNode* rows = (count > 0) ? rowTreeBuild(nodes, count) : NULL;
+	free(nodes);
+	if (count > 0 && !rows) {
+		free(data);
+		return false;
 	}
+
+	// Replace the previous window, whose edits can't be undone once its rows are gone
+	rowNodeFree(page->rows);
+	pieceTableClear(&page->text);
+	undoJournalClear(&page->undo);
+	page->text.original = data;
+	page->text.originalSize = used;
+	page->rows = rows;
+	page->numRows = chunk.numRows;
+	huge->windowLine = line;
+	huge->windowStart = start;
+	huge->windowEnd = start + used;
+	if (chunk.numCRLF > 0 && chunk.numLF == 0) {
+		PAGE_FLAG_SET(page, EF_CRLF);
+	} else {
+		PAGE_FLAG_CLEAR(page, EF_CRLF);
+	}
+	return true;
 }
 
-static void correctForTabs(editorContext* ctx, editorPage* page, editorRow* currRow, editorRow* nextRow) {
-	int currTabs = 0;
-	for(int i=0; i<page->cx; ++i) {
-		if (strbufGetChar(&currRow->text, i) == '\t') { currTabs++; }
-	}
-	int nextTabs = 0;
-	for(int i=0; i<page->cx; ++i) {
-		if (strbufGetChar(&nextRow->text, i) == '\t') { nextTabs++; }
-	}
-	if (currTabs != nextTabs) {
-		int currRx = rowCxToRx(ctx, currRow, page->cx);
-		int nextRx = 0;
-		int nextCx = 0;
-		for(; nextCx<page->cx && nextRx < currRx; ++nextCx) {
-			if (strbufGetChar(&nextRow->text, nextCx) == '\t') { nextRx += (ctx->settingTabStop - 1); }
-			nextRx++;
-		}
-		if (strbufGetChar(&nextRow->text, nextCx - 1) == '\t') {
-			page->cx = nextCx - 1;
-		} else {
-			page->cx -= (nextTabs - currTabs) * (ctx->settingTabStop - 1);
+int64_t pageGetLineBase(editorPage* page) {
+	return (page && page->huge) ? page->huge->windowLine : 0;
+}
+
+int64_t pageGetLineCount(editorPage* page) {
+	if (!page) { return 0; }
+	if (!page->huge) { return page->numRows; }
+
+	int64_t lines = 0;
+	hugeFileProgress(page->huge, &lines, NULL);
+	return MAX(lines, page->huge->windowLine + page->numRows);
+}
+
+bool pageGotoLine(editorContext* ctx, editorPage* page, int64_t line) {
+	if (!ctx || !page || line < 0) { return false; }
+
+	if (page->huge) {
+		// Centre the window on the line, leaving room to scroll either way
+		if (hugeFileProgress(page->huge, NULL, NULL)) {
+			line = MIN(line, pageGetLineCount(page) - 1);
+		}
+		if (!pageLoadWindow(ctx, page, MAX(0, line - HUGE_WINDOW_ROWS / 2))) { return false; }
+		line -= page->huge->windowLine;
+	}
+	if (page->numRows == 0) { return true; }
+
+	// Put the line in the middle of the screen
+	page->cy = (int)MIN(line, (int64_t)page->numRows - 1);
+	page->cx = 0;
+	page->rowOff = MAX(0, page->cy - ctx->screenRows / 2);
+	return true;
+}
+
+bool pageGotoOffset(editorContext* ctx, editorPage* page, int64_t offset) {
+	if (!ctx || !page || offset < 0) { return false; }
+
+	// Find the line containing the offset, and where it starts
+	int64_t line = 0;
+	int64_t lineStart = 0;
+	if (page->huge) {
+		offset = MIN(offset, page->huge->fileSize - 1);
+		if (!hugeFileFindOffset(page->huge, offset, &line)) { return false; }
+		if (!hugeFileFindLine(page->huge, line, &lineStart)) { return false; }
+	} else {
+		int newlineLen = PAGE_FLAG_ISSET(page, EF_CRLF) ? 2 : 1;
+		rowIter it;
+		for(editorRow* row = pageSeekRow(page, 0, &it); row; row = rowIterNext(&it)) {
+			if (offset < lineStart + row->size + newlineLen || line == page->numRows - 1) { break; }
+			lineStart += row->size + newlineLen;
+			line++;
 		}
 	}
+	if (!pageGotoLine(ctx, page, line)) { return false; }
+
+	// Move to the column within the line
+	editorRow* row = PAGE_CURR_ROW(page);
+	if (row) {
+		page->cx = (int)MIN(offset - lineStart, (int64_t)row->size);
+	}
+	return true;
+}
+
+static void correctForTabs(editorContext* ctx, editorPage* page, editorRow* currRow, editorRow* nextRow) {
+	// Keep the cursor in the same rendered column on the new row
+	page->cx = rowRxToCx(ctx, nextRow, rowCxToRx(ctx, currRow, page->cx));
 }
 
 void pageMoveCursor(editorContext* ctx, editorPage* page, int dir, int num) {
+	// Vertical moves jump straight to the destination row
+	if (dir == ED_UP || dir == ED_DOWN) {
+		int target = (dir == ED_DOWN) ? MIN(page->cy + num, page->numRows) : MAX(page->cy - num, 0);
+		if (target == page->cy) { return; }
+		editorRow* currRow = pageGetRow(page, page->cy);
+		editorRow* nextRow = pageGetRow(page, target);
+		if (currRow && nextRow && page->cx > 0) {
+			correctForTabs(ctx, page, currRow, nextRow);
+		}
+		page->cy = target;
+
+		// Snap cursor to line endings
+		int rowLen = nextRow ? nextRow->size : 0;
+		if (page->cx > rowLen) { page->cx = rowLen; }
+		return;
+	}
+
 	for(int r=0; r<num; ++r) {
-		editorRow* currRow = (page->cy >= page->numRows) ? NULL : &page->rows[page->cy];
+		editorRow* currRow = pageGetRow(page, page->cy);
 		editorRow* nextRow = currRow;
 
 		// Move cursor
 		switch(dir) {
-			case ED_DOWN: {
-				if (page->cy < page->numRows) { 
-					// Correct for tabs
-					nextRow = (page->cy + 1 >= page->numRows) ? NULL : &page->rows[page->cy + 1];
-					if (nextRow && page->cx > 0) {
-						correctForTabs(ctx, page, currRow, nextRow);
-					}
-
-					// Move line
-					page->cy++; 
-				}
-			} break;
-			case ED_UP: {
-				if (page->cy != 0) { 
-					// Correct for tabs
-					nextRow = (page->cy - 1 >= page->numRows) ? NULL : &page->rows[page->cy - 1];
-					if (nextRow && page->cx > 0) {
-						correctForTabs(ctx, page, currRow, nextRow);
-					}
-					
-					// Move line
-					page->cy--; 
-				}
-			} break;
 			case ED_LEFT: {
 				if (page->cx != 0) { page->cx--; }
 				else if (page->cy > 0) {
-					nextRow = (page->cy - 1 >= page->numRows) ? NULL : &page->rows[page->cy - 1];
+					nextRow = pageGetRow(page, page->cy - 1);
 					page->cy--;
-					page->cx = page->rows[page->cy].text.size;
+					page->cx = nextRow ? nextRow->size : 0;
 				}
 			} break;
 			case ED_RIGHT: {
-				if (currRow && (unsigned int)(page->cx) < currRow->text.size) { page->cx++; }
-				else if (currRow && (unsigned int)(page->cx) == currRow->text.size) {
-					nextRow = (page->cy + 1 >= page->numRows) ? NULL : &page->rows[page->cy + 1];
+				if (currRow && (unsigned int)(page->cx) < currRow->size) { page->cx++; }
+				else if (currRow && (unsigned int)(page->cx) == currRow->size) {
+					nextRow = pageGetRow(page, page->cy + 1);
 					page->cy++;
 					page->cx = 0;
 				}
@@ -465,56 +4389,437 @@ void pageMoveCursor(editorContext* ctx, editorPage* page, int dir, int num) {
 		}
 
 		// Snap cursor to line endings
-		int rowLen = nextRow ? nextRow->text.size : 0;
+		int rowLen = nextRow ? nextRow->size : 0;
 		if (page->cx > rowLen) { page->cx = rowLen; }
 	}
 }
 
-void pageSetCursorRow(editorPage* page, int at) {
-	if (!page) { return; }
-
-	// Check boundaries
-	if (at < 0 || at > page->numRows) { at = page->numRows - 1; }
-	page->cy = at;
-}
-
-void pageSetCursorCol(editorPage* page, int at) {
-	if (!page) { return; }
+void pageSetCursorRow(editorPage* page, int at) {
+	if (!page) { return; }
+
+	// Check boundaries
+	if (at < 0 || at > page->numRows) { at = page->numRows - 1; }
+	page->cy = at;
+}
+
+void pageSetCursorCol(editorPage* page, int at) {
+	if (!page) { return; }
+
+	// Get current row
+	editorRow* row = PAGE_CURR_ROW(page);
+	if (!row) { 
+		page->cx = 0; 
+		return;
+	}
+
+	// Check boundaries
+	if (at < 0 || (unsigned int)at > row->size) { at = row->size; }
+	page->cx = at;
+}
+
+static char* pageJournalPath(const char* filename, const char* suffix) {
+	// Journals are kept next to their file, hidden like the temporary files saves use
+	size_t len = strlen(filename) + strlen(suffix) + 3;
+	char* path = malloc(len);
+	if (!path) { return NULL; }
+	const char* base = strrchr(filename, '/');
+	base = base ? base + 1 : filename;
+	snprintf(path, len, "%.*s.%s.%s", (int)(base - filename), filename, base, suffix);
+	return path;
+}
+
+static void pageLoadJournals(editorPage* page, const char* filename) {
+	if (page->huge) { return; }
+
+	// Pick up the history saved with the file, if the file hasn't changed since,
+	// and any edits to it left in a swap file by an editor that didn't get to save them
+	contentHash hash;
+	contentHashInit(&hash);
+	contentHashUpdate(&hash, page->text.original, page->text.originalSize);
+	page->savedHash = contentHashFinal(&hash);
+	page->savedSize = page->text.originalSize;
+	char* realname = realpath(filename, NULL);
+	char* path = realname ? pageJournalPath(realname, "undo") : NULL;
+	char* swapPath = realname ? pageJournalPath(realname, "swp") : NULL;
+	if (path) {
+		undoJournalLoad(&page->undo, path, page->savedHash, page->savedSize);
+	}
+	swapRecovery* recovery = swapPath ? malloc(sizeof(*recovery)) : NULL;
+	if (recovery && swapRecoveryLoad(recovery, swapPath, page->savedHash, page->savedSize)) {
+		page->recovery = recovery;
+	} else if (recovery) {
+		if (recovery->locked) { PAGE_FLAG_SET(page, EF_NOSWAP); }
+		free(recovery);
+	}
+	free(swapPath);
+	free(path);
+	free(realname);
+}
+
+static void pageAttachSwap(editorContext* ctx, editorPage* page, const char* filename) {
+	// Huge files are edited a window at a time, so there's nothing to replay their edits onto
+	if (page->huge || PAGE_FLAG_ISSET(page, EF_READONLY) || PAGE_FLAG_ISSET(page, EF_NOSWAP)) { return; }
+	char* realname = realpath(filename, NULL);
+	char* path = pageJournalPath(realname ? realname : filename, "swp");
+	free(realname);
+	if (!path) { return; }
+
+	// Saving under a new name moves the page's unsaved edits to a swap file next to it
+	if (page->swap && strcmp(page->swap->path, path) != 0) {
+		swapFileClose(page->swap, true);
+		page->swap = NULL;
+	}
+	if (!page->swap) {
+		page->swap = swapFileOpen(&ctx->swaps, path, page->savedHash, page->savedSize);
+	}
+	free(path);
+}
+
+/// @brief Everything a worker needs to write a page out. The rows are a
+/// @brief snapshot of the page, which carries on being edited in the meantime.
+/// @brief Text is gathered into spans and written a batch at a time.
+typedef struct {
+	editorContext* ctx;
+	rowNode* rows;
+	int numRows;
+	const char* original;
+	size_t originalSize;
+	char* filename;
+	char* tempname;
+	int fd;
+	bool crlf;
+	bool sync;
+	bool failed;
+	struct iovec spans[SAVE_MAX_SPANS];
+	int numSpans;
+	contentHash hash;
+	int undoCheckpoint;
+	undoBatch undoBatch;
+	int swapCheckpoint;
+} pageSaveJob;
+
+static void pageSaveFlush(pageSaveJob* save) {
+	// Hash the text on its way out, so the page's history can be matched up with the file later
+	for(int i=0; i<save->numSpans; ++i) {
+		contentHashUpdate(&save->hash, save->spans[i].iov_base, save->spans[i].iov_len);
+	}
+	if (!save->failed && !fileWriteSpans(save->fd, save->spans, save->numSpans)) {
+		save->failed = true;
+	}
+	save->numSpans = 0;
+}
+
+static void pageSaveSpan(pageSaveJob* save, const char* data, size_t len) {
+	if (len == 0) { return; }
+
+	// Text that carries on from the last span joins it
+	if (save->numSpans > 0) {
+		struct iovec* last = &save->spans[save->numSpans - 1];
+		if ((const char*)(last->iov_base) + last->iov_len == data) {
+			last->iov_len += len;
+			return;
+		}
+	}
+	if (save->numSpans == SAVE_MAX_SPANS) {
+		pageSaveFlush(save);
+	}
+	save->spans[save->numSpans].iov_base = (void*)(data);
+	save->spans[save->numSpans].iov_len = len;
+	save->numSpans++;
+}
+
+static void pageSaveRows(workerJob* job, pageSaveJob* save, rowNode* node, int* numWritten) {
+	// Leaf links belong to the live page, so the snapshot is walked from the top
+	if (!node->leaf) {
+		for(int i=0; i<node->numChildren && !save->failed; ++i) {
+			pageSaveRows(job, save, node->children[i], numWritten);
+		}
+		return;
+	}
+	const char* newline = save->crlf ? "\r\n" : "\n";
+	size_t newlineLen = save->crlf ? 2 : 1;
+	const char* originalEnd = save->original + save->originalSize;
+	for(int r=0; r<node->numChildren; ++r) {
+		editorRow* row = &node->rows[r];
+		textPiece* pieces = rowGetPieces(row);
+		for(int i=0; i<row->numPieces; ++i) {
+			pageSaveSpan(save, pieces[i].data, pieces[i].len);
+		}
+
+		// Rows that haven't been edited are followed by their newline in the
+		// original file, so unchanged stretches go out as one span
+		const char* end = (save->numSpans > 0) ? (const char*)(save->spans[save->numSpans - 1].iov_base) + save->spans[save->numSpans - 1].iov_len : NULL;
+		if (end && end >= save->original && end + newlineLen <= originalEnd && memcmp(end, newline, newlineLen) == 0) {
+			pageSaveSpan(save, end, newlineLen);
+		} else {
+			pageSaveSpan(save, newline, newlineLen);
+		}
+		if (++(*numWritten) % SAVE_PROGRESS_ROWS == 0) {
+			workerJobSetProgress(job, *numWritten, save->numRows);
+		}
+	}
+}
+
+static void pageSaveRun(workerJob* job) {
+	pageSaveJob* save = (pageSaveJob*)(job->data);
+
+	// Write everything to the temporary file, or over the file itself when there isn't one
+	int numWritten = 0;
+	if (!save->tempname) {
+		save->failed = (ftruncate(save->fd, 0) != 0);
+	}
+	if (save->rows && !save->failed) {
+		pageSaveRows(job, save, save->rows, &numWritten);
+	}
+	pageSaveFlush(save);
+	if (save->sync && !save->failed) {
+		save->failed = ((save->tempname ? fsync(save->fd) : fdatasync(save->fd)) != 0);
+	}
+	save->failed |= (close(save->fd) != 0);
+
+	// The ops the text is made from go in the journal file ahead of its mark
+	undoBatchRun(&save->undoBatch);
+	if (!save->tempname) { return; }
+
+	// Then swap it in for the real one. The old file lives on for as long as
+	// it's mapped, so rows pointing into it stay valid
+	if (!save->failed) {
+		save->failed = (rename(save->tempname, save->filename) != 0);
+	}
+	if (save->failed) {
+		unlink(save->tempname);
+		return;
+	}
+	if (save->sync) {
+		char* dir = strdup(save->filename);
+		int dirFd = dir ? open(dirname(dir), O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+		if (dirFd >= 0) {
+			fsync(dirFd);
+			close(dirFd);
+		}
+		free(dir);
+	}
+}
+
+static void pageSaveDone(workerJob* job) {
+	pageSaveJob* save = (pageSaveJob*)(job->data);
+	editorContext* ctx = save->ctx;
+
+	// Drop the snapshot of whichever page the job belongs to now. The page
+	// was marked clean when the snapshot was taken, so it's only dirty now if
+	// it was edited since, or the save didn't make it to disk
+	for(int i=0; i<ctx->numPages; ++i) {
+		editorPage* page = &ctx->pages[i];
+		if (page->job != job) { continue; }
+		page->job = NULL;
+		pageReleaseSnapshot(page);
+		undoJournalFinish(&page->undo, &save->undoBatch);
+		if (save->failed && PAGE_FLAG_ISCLEAR(page, EF_READONLY)) {
+			PAGE_FLAG_SET(page, EF_DIRTY);
+		} else if (!save->failed) {
+			// Only edits made since the save started are left to recover
+			page->savedHash = contentHashFinal(&save->hash);
+			page->savedSize = save->hash.size;
+			undoJournalMark(&page->undo, save->undoCheckpoint, page->savedHash, page->savedSize);
+			if (PAGE_FLAG_ISSET(page, EF_DIRTY)) {
+				swapFileMark(page->swap, save->swapCheckpoint, page->savedHash, page->savedSize);
+			} else {
+				swapFileReset(page->swap, page->savedHash, page->savedSize);
+			}
+		}
+	}
+	if (save->failed) {
+		editorSetMessage(ctx, "Failed to save file (%s)!", save->filename);
+	} else {
+		editorSetMessage(ctx, "Saved successfully!");
+	}
+	undoBatchClear(&save->undoBatch);
+	free(save->filename);
+	free(save->tempname);
+	free(save);
+	free(job);
+}
+
+static int pageSaveOpen(char* filename, char** tempname) {
+	// Files with other names linked to them are written in place, so the links keep sharing them
+	struct stat st;
+	bool exists = (stat(filename, &st) == 0);
+	if (!exists || st.st_nlink <= 1) {
+		// Make the temporary file in the same directory, so it can be renamed over the real one
+		size_t len = strlen(filename);
+		*tempname = malloc(len + 9);
+		if (!*tempname) { return -1; }
+		char* base = strrchr(filename, '/');
+		base = base ? base + 1 : filename;
+		snprintf(*tempname, len + 9, "%.*s.%s.XXXXXX", (int)(base - filename), filename, base);
+		int fd = mkostemp(*tempname, O_CLOEXEC);
+		if (fd >= 0) {
+			// Give it the permissions of the file it replaces, or the usual ones for a new file
+			if (exists) {
+				int owned = fchown(fd, st.st_uid, st.st_gid);
+				(void)(owned);
+				fchmod(fd, st.st_mode & 07777);
+			} else {
+				mode_t mask = umask(0);
+				umask(mask);
+				fchmod(fd, 0666 & ~mask);
+			}
+			return fd;
+		}
+		int error = errno;
+		free(*tempname);
+		*tempname = NULL;
+
+		// A directory that can't be written to may still hold a file that can
+		if (error != EACCES && error != EROFS) { return -1; }
+	}
+	return open(filename, O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+}
+
+static bool pageSaveDetach(editorContext* ctx, const char* filename) {
+	// Writing in place changes the file under any page that has it mapped
+	bool detached = true;
+	for(int i=0; i<ctx->numPages; ++i) {
+		editorPage* page = &ctx->pages[i];
+		if (!page->text.mapped || !page->fullFilename) { continue; }
+		char* path = realpath(page->fullFilename, NULL);
+		if (path && strcmp(path, filename) == 0) {
+			detached &= pieceTableDetach(&page->text);
+		}
+		free(path);
+	}
+	return detached;
+}
+
+static int pageCheckpointHistory(editorPage* page, const char* filename, undoBatch* batch) {
+	// Huge files are edited a window at a time, so their history can't outlive the window
+	if (page->huge) { return -1; }
+	char* path = pageJournalPath(filename, "undo");
+	if (!path) { return -1; }
+	int checkpoint = undoJournalCheckpoint(&page->undo, path, batch);
+	free(path);
+	return checkpoint;
+}
+
+static bool pageSaveName(editorContext* ctx, editorPage* page) {
+	if (page->filename) { return true; }
+
+	// Ask for a name for new pages
+	editorSetPage(ctx, pageGetNumber(ctx, page));
+	strbuf inputFilename;
+	editorPrompt(ctx, &inputFilename, "File name: %s");
+	if (inputFilename.data) {
+		pageSetFullFilename(page, inputFilename.data);
+	}
+	strbufClear(&inputFilename);
+	return page->filename != NULL;
+}
+
+static bool pageCheckChanged(editorContext* ctx, editorPage* page) {
+	// Text mapped from a file changes along with it, so it's copied out
+	// before it can change any further
+	if (!pieceTableChanged(&page->text)) { return PAGE_FLAG_ISSET(page, EF_CHANGED); }
+	pieceTableDetach(&page->text);
+	PAGE_FLAG_SET(page, EF_CHANGED);
+	editorSetMessage(ctx, "File changed on disk (%s)! Some of its text may be wrong.", page->filename);
+	return true;
+}
+
+static bool pageSaveChanged(editorContext* ctx, editorPage* page) {
+	if (!pageCheckChanged(ctx, page)) { return true; }
+
+	// Saving would write over the other program's changes with text that may have gone wrong
+	editorSetPage(ctx, pageGetNumber(ctx, page));
+	while(1) {
+		strbuf input;
+		editorPrompt(ctx, &input, "File changed on disk! Save anyway? (y=Yes / n=No) %s");
+		if (input.data) {
+			STR_TOLOWER(input.data);
+			if (strcmp(input.data, "y") == 0) {
+				strbufClear(&input);
+				PAGE_FLAG_CLEAR(page, EF_CHANGED);
+				return true;
+			} else if (input.size == 0 || strcmp(input.data, "n") == 0) {
+				strbufClear(&input);
+				return false;
+			}
+		} else {
+			strbufClear(&input);
+			return false;
+		}
+		strbufClear(&input);
+	}
+}
+
+static bool pageSaveStart(editorContext* ctx, editorPage* page) {
+	// Write through symlinks rather than replacing them
+	char* filename = realpath(page->fullFilename, NULL);
+	if (!filename) {
+		filename = strdup(page->fullFilename);
+		if (!filename) { return false; }
+	}
 
-	// Get current row
-	editorRow* row = PAGE_CURR_ROW(page);
-	if (!row) { 
-		page->cx = 0; 
-		return;
+	// Open temporary file
+	char* tempname = NULL;
+	int fd = pageSaveOpen(filename, &tempname);
+	workerJob* job = (fd >= 0) ? calloc(1, sizeof(*job)) : NULL;
+	pageSaveJob* save = job ? calloc(1, sizeof(*save)) : NULL;
+	if (save && !tempname && !pageSaveDetach(ctx, filename)) {
+		free(save);
+		save = NULL;
+	}
+	if (!save) {
+		if (fd >= 0) {
+			close(fd);
+			if (tempname) { unlink(tempname); }
+		}
+		free(job);
+		free(tempname);
+		free(filename);
+		return false;
 	}
 
-	// Check boundaries
-	if (at < 0 || (unsigned int)at > row->text.size) { at = row->text.size; }
-	page->cx = at;
+	// Hand the write off to a worker
+	save->ctx = ctx;
+	pageTakeSnapshot(page);
+	save->rows = page->rows;
+	save->numRows = page->numRows;
+	save->original = page->text.original;
+	save->originalSize = page->text.originalSize;
+	save->filename = filename;
+	save->tempname = tempname;
+	save->fd = fd;
+	save->crlf = PAGE_FLAG_ISSET(page, EF_CRLF);
+	save->sync = ctx->settingSaveSync;
+	contentHashInit(&save->hash);
+	save->undoBatch.fd = -1;
+	save->undoCheckpoint = pageCheckpointHistory(page, filename, &save->undoBatch);
+	pageAttachSwap(ctx, page, filename);
+	save->swapCheckpoint = swapFileCheckpoint(page->swap);
+	job->run = pageSaveRun;
+	job->done = pageSaveDone;
+	job->data = save;
+	page->job = job;
+	PAGE_FLAG_CLEAR(page, EF_DIRTY);
+	if (!workerPoolSubmit(&ctx->workers, job)) {
+		// Without a thread to run on, save on this one
+		pageSaveRun(job);
+		pageSaveDone(job);
+		return true;
+	}
+	editorSetMessage(ctx, "Saving...");
+	return true;
 }
 
 void pageSave(editorContext* ctx, editorPage* page) {
 	if (!page || PAGE_FLAG_ISCLEAR(page, EF_DIRTY)) { return; }
-
-	if (!page->filename) {
-		editorSetPage(ctx, pageGetNumber(ctx, page));
-		strbuf inputFilename;
-		editorPrompt(ctx, &inputFilename, "File name: %s");
-		if (inputFilename.data) {
-			pageSetFullFilename(page, inputFilename.data);
-		} else {
-			strbufClear(&inputFilename);
-			return;
-		}
-		strbufClear(&inputFilename);
+	if (page->job) {
+		editorSetMessage(ctx, "File is already being saved!");
+		return;
 	}
+	if (!pageSaveName(ctx, page) || !pageSaveChanged(ctx, page)) { return; }
 
-	// Open file
-	FILE* fp = NULL;
-	while(1) {
-		fp = fopen(page->fullFilename, "w");
-		if (fp) { break; }
-
+	while(!pageSaveStart(ctx, page)) {
 		// Ask what to do in case of error
 		strbuf inputError;
 		editorPrompt(ctx, &inputError, "Failed to open file (%s)! (r=Retry / c=Cancel):");
@@ -522,7 +4827,7 @@ void pageSave(editorContext* ctx, editorPage* page) {
 			STR_TOLOWER(inputError.data);
 			if (strcmp(inputError.data, "r") == 0) {
 				strbufClear(&inputError);
-			} else if (strcmp(inputError.data, "c") == 0) {
+			} else if (inputError.size == 0 || strcmp(inputError.data, "c") == 0) {
 				strbufClear(&inputError);
 				return;
 			}
@@ -531,18 +4836,6 @@ void pageSave(editorContext* ctx, editorPage* page) {
 			return;
 		}
 	}
-
-	// Write to file
-	for(int rowIdx = 0; rowIdx < page->numRows; ++rowIdx) {
-		editorRow* row = &page->rows[rowIdx];
-		fputs(row->text.data,fp);
-		fputs("\n", fp);
-	}
-	fclose(fp);
-
-	// Update flags
-	editorSetMessage(ctx, "Saved successfully!");
-	PAGE_FLAG_CLEAR(page, EF_DIRTY);
 }
 
 void pageSetFullFilename(editorPage* page, char* fullFilename) {
@@ -568,6 +4861,26 @@ int pageGetNumber(editorContext* ctx, editorPage* page) {
 	return -1;
 }
 
+static int64_t editorClock() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t)(ts.tv_sec) * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static void editorResize(editorContext* ctx) {
+	// Rows between the header and footer are left for text
+	ctx->frame.backend->getSize(&ctx->frame, &ctx->screenRows, &ctx->screenCols);
+	ctx->screenRows -= (NEO_HEADER + NEO_FOOTER);
+	ctx->frame.full = true;
+}
+
+static void editorOnJobs(void* data, int fd, uint32_t events) {
+	editorContext* ctx = (editorContext*)(data);
+	(void)(fd);
+	(void)(events);
+	workerPoolCollect(&ctx->workers);
+}
+
 void editorInit(editorContext* ctx) {
 	if (!ctx) { return; }
 
@@ -577,11 +4890,31 @@ void editorInit(editorContext* ctx) {
 	ctx->maxPages = 0;
 	ctx->numPages = 0;
 	ctx->currPage = -1;
-	getmaxyx(stdscr, ctx->screenRows, ctx->screenCols);
-	ctx->screenRows -= (NEO_HEADER + NEO_FOOTER);
 	ctx->state = ES_OPEN;
 	ctx->pageOff = 0;
-	ctx->settingTabStop = 4;
+	ctx->settingTabStop = NEO_TAB_STOP;
+	ctx->settingInputBudget = NEO_INPUT_BUDGET;
+	ctx->settingSaveSync = SAVE_SYNC;
+	ctx->settingUndoLimit = UNDO_MAX_SIZE;
+	frameInit(&ctx->frame);
+	editorResize(ctx);
+	keyQueueInit(&ctx->input);
+	ctx->keyLog = NULL;
+	ctx->keyLogStart = 0;
+	ctx->signalFd = -1;
+	ctx->timerDeadline = -1;
+
+	// Timers go through the event loop like everything else, so the editor
+	// sleeps until something actually needs doing
+	eventLoopInit(&ctx->events);
+	ctx->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	// Saves mostly wait on the disk, so they're allowed more threads than there are cores
+	if (workerPoolInit(&ctx->workers, WORKER_MAX_THREADS)) {
+		eventLoopAdd(&ctx->events, ctx->workers.eventFd, editorOnJobs, ctx);
+	}
+	swapWriterInit(&ctx->swaps, SWAP_COMMIT_DELAY);
+	ctx->drawnPage = -1;
+	ctx->drawnLine = 0;
 
 	// Hard code menu groups
 	ctx->currMenu = 0;
@@ -614,6 +4947,7 @@ void editorInit(editorContext* ctx) {
 	entry.name = "Paste"; entry.shortcut = 'v'; menuGroupInsert(menuEdit, -1, entry);
 	menuGroupInsert(menuEdit, -1, spacer);
 	entry.name = "Select All"; entry.shortcut = 'a'; menuGroupInsert(menuEdit, -1, entry);
+	entry.name = "Go To Line"; entry.shortcut = 'g'; menuGroupInsert(menuEdit, -1, entry);
 	menuGroupInsert(menuEdit, -1, spacer);
 	entry.name = "Undo"; entry.shortcut = 'z'; menuGroupInsert(menuEdit, -1, entry);
 	entry.name = "Redo"; entry.shortcut = 'y'; menuGroupInsert(menuEdit, -1, entry);
@@ -626,31 +4960,63 @@ void editorInit(editorContext* ctx) {
 void editorClear(editorContext* ctx) {
 	if (!ctx) { return; }
 
+	// Let saves finish before the pages they're writing go away
+	workerPoolClear(&ctx->workers);
 	for(int i=0; i<ctx->numPages; ++i) { 
 		pageClear(&ctx->pages[i]); 
 	}
+	swapWriterClear(&ctx->swaps);
 	for(int i=0; i<ctx->numMenus; ++i) {
 		menuGroupClear(&ctx->menus[i]);
 	}
 	free(ctx->pages);
 	free(ctx->menus);
+	frameClear(&ctx->frame);
+	keyQueueClear(&ctx->input);
+	if (ctx->keyLog) {
+		fclose(ctx->keyLog);
+		ctx->keyLog = NULL;
+	}
+	eventLoopClear(&ctx->events);
+	if (ctx->signalFd >= 0) {
+		close(ctx->signalFd);
+		ctx->signalFd = -1;
+	}
+	if (ctx->timerFd >= 0) {
+		close(ctx->timerFd);
+		ctx->timerFd = -1;
+	}
 }
 
 void editorUpdate(editorContext* ctx) {
 	if (!ctx) { editorAbort(ctx, 1); }
 
-	// Query terminfo for window size
-	if (_neo_flag_resized) {
-		getmaxyx(stdscr, ctx->screenRows, ctx->screenCols);
-		ctx->screenRows -= (NEO_HEADER + NEO_FOOTER);
-		_neo_flag_resized = false;
+	// Pick up jobs that finished without the event loop noticing
+	workerPoolCollect(&ctx->workers);
+
+	// Catch files changed under their pages before they're drawn or saved
+	for(int i=0; i<ctx->numPages; ++i) {
+		pageCheckChanged(ctx, &ctx->pages[i]);
 	}
 
-	for(int i=0; i<ctx->numPages; ++i) { 
-		pageUpdate(ctx, &ctx->pages[i]); 
+	// Pages in the background are only rendered once they're switched to, and
+	// only offered the edits left in their swap files then too
+	if (ctx->currPage >= 0 && ctx->currPage < ctx->numPages) {
+		editorPage* page = EDITOR_CURR_PAGE(ctx);
+		if (page->recovery && ctx->state == ES_OPEN) {
+			editorRecoverPage(ctx, page);
+		}
+		pageUpdate(ctx, page);
 	}
 }
 
+void editorSetBackend(editorContext* ctx, const frameBackend* backend) {
+	if (!ctx || !backend) { return; }
+
+	frameSetBackend(&ctx->frame, backend);
+	editorResize(ctx);
+}
+
 void editorGrowPages(editorContext* ctx) {
 	if (!ctx) { return; }
 
@@ -661,6 +5027,24 @@ void editorGrowPages(editorContext* ctx) {
 	ctx->maxPages = newSize;
 }
 
+bool editorIsBusy(editorContext* ctx) {
+	if (!ctx) { return false; }
+
+	if (workerPoolIsBusy(&ctx->workers)) { return true; }
+	for(int i=0; i<ctx->numPages; ++i) {
+		editorPage* page = &ctx->pages[i];
+		if (page->huge && !hugeFileProgress(page->huge, NULL, NULL)) { return true; }
+	}
+	return false;
+}
+
+void editorWaitJobs(editorContext* ctx) {
+	if (!ctx) { return; }
+
+	workerPoolWait(&ctx->workers, NULL);
+	workerPoolCollect(&ctx->workers);
+}
+
 int editorGetState(editorContext* ctx) {
 	if (!ctx) { return ES_SHOULD_CLOSE; }
 	return ctx->state;
@@ -669,11 +5053,14 @@ int editorGetState(editorContext* ctx) {
 void editorPrint(editorContext* ctx) {
 	if (!ctx) { editorAbort(ctx, 1); }
 
+	editorFrame* frame = &ctx->frame;
+	frameBegin(frame, ctx->screenRows + NEO_HEADER + NEO_FOOTER, ctx->screenCols);
+
 	// Calculate rendered cursor position
 	editorPage* currPage = EDITOR_CURR_PAGE(ctx);
-	if (currPage->cy < currPage->numRows) {
-		editorRow* row = &currPage->rows[currPage->cy];
-		currPage->rx = rowCxToRx(ctx, row, currPage->cx);
+	editorRow* cursorRow = PAGE_CURR_ROW(currPage);
+	if (cursorRow) {
+		currPage->rx = rowCxToRx(ctx, cursorRow, currPage->cx);
 	} else { 
 		currPage->rx = 0; 
 	}
@@ -694,14 +5081,30 @@ void editorPrint(editorContext* ctx) {
 	}
 	if (currPage->rx + NEO_SCROLL_MARGIN >= currPage->colOff + ctx->screenCols) { 
 		editorRow* row = PAGE_CURR_ROW(currPage);
+		rowUpdate(ctx, row);
+		if (row->width != row->rtext.size) {
+			pageSetRowWidth(currPage, currPage->cy, row->rtext.size);
+		}
 		currPage->colOff = MIN(
 			((int)row->rtext.size + NEO_SCROLL_MARGIN + 1) - ctx->screenCols,
 			(currPage->rx - ctx->screenCols) + NEO_SCROLL_MARGIN + 1
 		);
 	}
 
+	// Scroll the text instead of redrawing it when the view only moved a few lines
+	int64_t topLine = pageGetLineBase(currPage) + currPage->rowOff;
+	int64_t scroll = topLine - ctx->drawnLine;
+	if (ctx->drawnPage == ctx->currPage && scroll != 0 && llabs(scroll) < ctx->screenRows / 2) {
+		// The horizontal scroll bar covers the last row, and doesn't move
+		int bottom = NEO_HEADER + ctx->screenRows - 1;
+		if (pageGetNumCols(currPage) + NEO_SCROLL_MARGIN >= ctx->screenCols) { bottom--; }
+		frameScroll(frame, NEO_HEADER, bottom, (int)scroll);
+	}
+	ctx->drawnPage = ctx->currPage;
+	ctx->drawnLine = topLine;
+
 	// Render full page line
-	move(1, 0);
+	frameMove(frame, 1, 0);
 	strbuf pageLine;
 	strbufInit(&pageLine, ctx->screenCols);
 	for(int pageIdx=0; pageIdx<ctx->numPages; ++pageIdx) {
@@ -761,63 +5164,76 @@ void editorPrint(editorContext* ctx) {
 	}
 
 	// Trim page line to screen width
-	attron(A_REVERSE);
-	addnstr(&pageLine.data[ctx->pageOff], ctx->screenCols);
-	int drawLen = strbufLength(&pageLine) - ctx->pageOff;
-	while(drawLen < ctx->screenCols) {
-		addch(' ');
-		drawLen++;
-	}
-	attroff(A_REVERSE);
+	frameAttrOn(frame, A_REVERSE);
+	frameAddStr(frame, &pageLine.data[ctx->pageOff], ctx->screenCols);
+	frameFill(frame, ' ', ctx->screenCols - (strbufLength(&pageLine) - ctx->pageOff));
+	frameAttrOff(frame, A_REVERSE);
 	strbufClear(&pageLine);
 
 	// Write page
-	for(int i=0; i<ctx->screenRows; ++i) {
-		int rowIdx = i + currPage->rowOff;
-		editorRow* row = &currPage->rows[rowIdx];
-
-		if (rowIdx >= currPage->numRows) {
-			printw("~\n");
+	rowIter it;
+	editorRow* row = pageSeekRow(currPage, currPage->rowOff, &it);
+	for(int i=0; i<ctx->screenRows; ++i, row = rowIterNext(&it)) {
+		frameMove(frame, NEO_HEADER + i, 0);
+		if (!row) {
+			frameAddChar(frame, '~');
 		} else {
+			// Rows scrolled into view since the last update are rendered now
+			rowUpdate(ctx, row);
+			if (row->width != row->rtext.size) {
+				pageSetRowWidth(currPage, currPage->rowOff + i, row->rtext.size);
+			}
 			int len = row->rtext.size - currPage->colOff;
 			if (len < 0) { len = 0; }
 			if (len > ctx->screenCols) { len = ctx->screenCols; }
-			addnstr(row->rtext.data + currPage->colOff, len);
-			for(int j=len; j<ctx->screenCols; ++j) { addch(' '); }
+			frameAddStr(frame, row->rtext.data + currPage->colOff, len);
 		}
 	}
 
 	// Write status message
-	attron(A_REVERSE);
+	frameMove(frame, NEO_HEADER + ctx->screenRows, 0);
+	frameAttrOn(frame, A_REVERSE);
 	int statusLen = strlen(ctx->statusMsg);
-	if (statusLen > 0 && time(NULL) - ctx->statusMsgTime < 5) {
-		addstr(ctx->statusMsg);
+	if (statusLen > 0 && editorClock() - ctx->statusMsgTime < NEO_STATUS_TIMEOUT * 1000) {
+		frameAddStr(frame, ctx->statusMsg, -1);
 	} else {
 		statusLen = 0;
 	}
 
 	// Write cursor position
 	if (ctx->state == ES_PROMPT) {
-		for(int i=statusLen; i<ctx->screenCols; ++i) { 
-			addch(' '); 
-		}
+		frameFill(frame, ' ', ctx->screenCols - statusLen);
 	} else {
-		char linePos[16];
-		int lineLen = snprintf(linePos, sizeof(linePos), "Ln %d, Col %d", currPage->cy + 1, currPage->rx + 1);
-		for(int i=statusLen; i<ctx->screenCols - lineLen; ++i) { 
-			addch(' '); 
-		}
-		addstr(linePos);
+		char linePos[48];
+		int lineLen = snprintf(
+			linePos, sizeof(linePos), "Ln %" PRId64 ", Col %d", 
+			pageGetLineBase(currPage) + currPage->cy + 1, 
+			currPage->rx + 1
+		);
+		frameFill(frame, ' ', ctx->screenCols - lineLen - statusLen);
+		frameAddStr(frame, linePos, -1);
 	}
-	attroff(A_REVERSE);
+	frameAttrOff(frame, A_REVERSE);
 
 	// Write bottom bar
-	char fileInfo[32];
+	char indexInfo[24] = "";
+	int percent = 0;
+	if (currPage->huge && !hugeFileProgress(currPage->huge, NULL, &percent)) {
+		snprintf(indexInfo, sizeof(indexInfo), " (INDEXING %d%%)", percent);
+	} else if (PAGE_FLAG_ISSET(currPage, EF_LOADING)) {
+		snprintf(indexInfo, sizeof(indexInfo), " (LOADING)");
+	} else if (currPage->job) {
+		snprintf(indexInfo, sizeof(indexInfo), " (SAVING %d%%)", workerJobGetPercent(currPage->job));
+	}
+	char fileInfo[80];
 	int infoLen = snprintf(
-		fileInfo, sizeof(fileInfo), "| Lines: %d%s", 
-		currPage->numRows,
+		fileInfo, sizeof(fileInfo), "| Lines: %" PRId64 "%s%s%s", 
+		pageGetLineCount(currPage),
+		indexInfo,
+		PAGE_FLAG_ISSET(currPage, EF_CRLF) ? " (CRLF)" : "",
 		PAGE_FLAG_ISSET(currPage, EF_READONLY) ? " (READ-ONLY)" : ""
 	);
+	frameMove(frame, NEO_HEADER + ctx->screenRows + 1, 0);
 	int fullFilenameDraw = 0;
 	int fullFilenameOff = 0;
 	int fullFilenameLen = 0;
@@ -827,95 +5243,95 @@ void editorPrint(editorContext* ctx) {
 			fullFilenameOff = ctx->screenCols - infoLen;
 		}
 		fullFilenameDraw += fullFilenameLen - fullFilenameOff;
-		addnstr(&currPage->fullFilename[fullFilenameOff], fullFilenameDraw);
-	}
-	for(int i=fullFilenameDraw; i<ctx->screenCols - infoLen; ++i) {
-		addch(' ');
+		frameAddStr(frame, &currPage->fullFilename[fullFilenameOff], fullFilenameDraw);
 	}
-	addnstr(fileInfo, infoLen);
+	frameFill(frame, ' ', ctx->screenCols - infoLen - fullFilenameDraw);
+	frameAddStr(frame, fileInfo, infoLen);
 
 	// Draw vertical scroll bar
-	bool drawVerticalBar = (currPage->numRows + NEO_SCROLL_MARGIN >= ctx->screenRows);
+	int64_t numLines = pageGetLineCount(currPage);
+	bool drawVerticalBar = (numLines + NEO_SCROLL_MARGIN >= ctx->screenRows);
 	if (drawVerticalBar) {
 		// Calculate scroll bar size
-		float sizeRatio = (ctx->screenRows) / (float)(currPage->numRows + 1 + NEO_SCROLL_MARGIN);
+		float sizeRatio = (ctx->screenRows) / (float)(numLines + 1 + NEO_SCROLL_MARGIN);
 		int barSize = MAX(1, (int)(sizeRatio * (ctx->screenRows - 2)));
 
 		// Calculate scroll bar offset
-		float offsetRatio = (currPage->rowOff) / (float)((currPage->numRows + 1 + NEO_SCROLL_MARGIN) - ctx->screenRows);
+		float offsetRatio = (pageGetLineBase(currPage) + currPage->rowOff) / (float)((numLines + 1 + NEO_SCROLL_MARGIN) - ctx->screenRows);
 		int barOffset = (int)(offsetRatio * (ctx->screenRows - 2 - barSize));
 
 		// Draw scrollbar
-		move(NEO_HEADER, ctx->screenCols - 1);
-		attron(A_REVERSE);
-		addch('^');
+		frameMove(frame, NEO_HEADER, ctx->screenCols - 1);
+		frameAttrOn(frame, A_REVERSE);
+		frameAddChar(frame, '^');
 		int i = 0;
 		for(; i<ctx->screenRows - NEO_HEADER; ++i) {
-			move(i + NEO_HEADER + 1, ctx->screenCols - 1);
+			frameMove(frame, i + NEO_HEADER + 1, ctx->screenCols - 1);
 			if (i >= barOffset && i < barSize + barOffset) {
-				addch(' ');
+				frameAddChar(frame, ' ');
 			} else {
-				attroff(A_REVERSE);
-				addch('|');
-				attron(A_REVERSE);
+				frameAttrOff(frame, A_REVERSE);
+				frameAddChar(frame, '|');
+				frameAttrOn(frame, A_REVERSE);
 			}
 		}
-		move(i + NEO_HEADER + 1, ctx->screenCols - 1);
-		addch('v');
-		attroff(A_REVERSE);
+		frameMove(frame, i + NEO_HEADER + 1, ctx->screenCols - 1);
+		frameAddChar(frame, 'v');
+		frameAttrOff(frame, A_REVERSE);
 	}
 
 	// Draw horizontal scroll bar
-	if (currPage->numCols + NEO_SCROLL_MARGIN >= ctx->screenCols) {
+	int numCols = pageGetNumCols(currPage);
+	if (numCols + NEO_SCROLL_MARGIN >= ctx->screenCols) {
 		// Calculate scroll bar size
-		float sizeRatio = (ctx->screenCols) / (float)(currPage->numCols + 1 + NEO_SCROLL_MARGIN);
+		float sizeRatio = (ctx->screenCols) / (float)(numCols + 1 + NEO_SCROLL_MARGIN);
 		int barSize = MAX(1, (int)(sizeRatio * (ctx->screenCols - 2)));
 
 		// Calculate scroll bar offset
-		float offsetRatio = (currPage->colOff) / (float)((currPage->numCols + 1 + NEO_SCROLL_MARGIN) - ctx->screenCols);
+		float offsetRatio = (currPage->colOff) / (float)((numCols + 1 + NEO_SCROLL_MARGIN) - ctx->screenCols);
 		int barOffset = (int)(offsetRatio * (ctx->screenCols - 2 - barSize));
 
 		// Draw scrollbar
-		move(NEO_HEADER + ctx->screenRows - 1, 0);
-		attron(A_REVERSE);
-		addch('<');
+		frameMove(frame, NEO_HEADER + ctx->screenRows - 1, 0);
+		frameAttrOn(frame, A_REVERSE);
+		frameAddChar(frame, '<');
 		int i = 0;
 		for(; i<ctx->screenCols - 2; ++i) {
-			move(NEO_HEADER + ctx->screenRows - 1, i + 1);
+			frameMove(frame, NEO_HEADER + ctx->screenRows - 1, i + 1);
 			if (i >= barOffset && i < barSize + barOffset) {
-				attron(A_UNDERLINE);
-				addch(' ');
-				attroff(A_UNDERLINE);
+				frameAttrOn(frame, A_UNDERLINE);
+				frameAddChar(frame, ' ');
+				frameAttrOff(frame, A_UNDERLINE);
 			} else {
-				attroff(A_REVERSE);
-				addch('-');
-				attron(A_REVERSE);
+				frameAttrOff(frame, A_REVERSE);
+				frameAddChar(frame, '-');
+				frameAttrOn(frame, A_REVERSE);
 			}
 		}
-		move(NEO_HEADER + ctx->screenRows - 1, i + 1);
-		addch(drawVerticalBar ? 'x' : '>');
-		attroff(A_REVERSE);
+		frameMove(frame, NEO_HEADER + ctx->screenRows - 1, i + 1);
+		frameAddChar(frame, drawVerticalBar ? 'x' : '>');
+		frameAttrOff(frame, A_REVERSE);
 	}
 
 	// Write menu bar
-	move(0, 0);
+	frameMove(frame, 0, 0);
 	for(int i=0; i<ctx->numMenus; ++i) {
 		menuGroup* menu = &ctx->menus[i];
 		if (!menu->name) { continue; }
 		if (ctx->state == ES_MENU && i == ctx->currMenu) { 
-			attron(A_REVERSE); 
+			frameAttrOn(frame, A_REVERSE); 
 		}
-		attron(A_UNDERLINE); 
-		addch(menu->name[0]);
-		attroff(A_UNDERLINE);
+		frameAttrOn(frame, A_UNDERLINE); 
+		frameAddChar(frame, menu->name[0]);
+		frameAttrOff(frame, A_UNDERLINE);
 		if (strlen(menu->name) > 1) {
-			addnstr(&menu->name[1], 7);
+			frameAddStr(frame, &menu->name[1], 7);
 		}
 		for(int i=strlen(menu->name); i<8; ++i) {
-			addch(' ');
+			frameAddChar(frame, ' ');
 		}
 		if (ctx->state == ES_MENU && i == ctx->currMenu) { 
-			attroff(A_REVERSE); 
+			frameAttrOff(frame, A_REVERSE); 
 		}
 	}
 	if (ctx->state == ES_MENU) {
@@ -924,19 +5340,20 @@ void editorPrint(editorContext* ctx) {
 
 	// Move cursor
 	if (ctx->state == ES_MENU) {
-		curs_set(0);
+		frameSetCursor(frame, 0, 0, false);
 	} else if (ctx->state == ES_PROMPT) {
-		curs_set(1);
-		move(ctx->screenRows + NEO_HEADER, 0);
+		frameSetCursor(frame, ctx->screenRows + NEO_HEADER, 0, true);
 	} else {
-		curs_set(1);
-		move(currPage->ry - currPage->rowOff, currPage->rx - currPage->colOff);
+		frameSetCursor(frame, currPage->ry - currPage->rowOff, currPage->rx - currPage->colOff, true);
 	}
+
+	// Only send the lines that changed
+	frameFlush(frame);
 }
 
 void editorPrintMenu(editorContext* ctx, menuGroup* grp, int off) {
-	(void)(ctx);
 	if (!ctx || !grp || off < 0) { return; }
+	editorFrame* frame = &ctx->frame;
 
 	// Calculate menu width
 	int menuLen = 0;
@@ -950,49 +5367,258 @@ void editorPrintMenu(editorContext* ctx, menuGroup* grp, int off) {
 		}
 		menuLen = MAX(menuLen, entryLen);
 	}
-	#define menuPrintLn(c) addch(c); for(int _c=0; _c<menuLen; ++_c) { addch('_'); } addch(c);
+	#define menuPrintLn(c) frameAddChar(frame, c); for(int _c=0; _c<menuLen; ++_c) { frameAddChar(frame, '_'); } frameAddChar(frame, c);
 
 	// Print menu box
-	attron(A_REVERSE);
-	move(1, off);
+	frameAttrOn(frame, A_REVERSE);
+	frameMove(frame, 1, off);
 	menuPrintLn(',');
 	int i=0;
 	for(; i<grp->numEntries; ++i) {
-		move(i + NEO_HEADER, off);
+		frameMove(frame, i + NEO_HEADER, off);
 		menuEntry entry = grp->entries[i];
 		if (!entry.name) {
 			// Seperator
 			menuPrintLn('|');
 		} else {
 			// Print name
-			addch('|');
-			if (grp->selected == i) { attroff(A_REVERSE); }
+			frameAddChar(frame, '|');
+			if (grp->selected == i) { frameAttrOff(frame, A_REVERSE); }
 			int len = strlen(entry.name);
-			addstr(entry.name);
+			frameAddStr(frame, entry.name, -1);
 			
 			// Print shortcut
 			if (isalnum(entry.shortcut)) {
 				if (isdigit(entry.shortcut)) {
-					while(len < (menuLen - 4)) { addch(' '); len++; }
-					addstr("(F");
-					addch(entry.shortcut);
-					addch(')');
+					while(len < (menuLen - 4)) { frameAddChar(frame, ' '); len++; }
+					frameAddStr(frame, "(F", -1);
+					frameAddChar(frame, entry.shortcut);
+					frameAddChar(frame, ')');
 				} else {
-					while(len < (menuLen - 8)) { addch(' '); len++; }
-					addstr("(Ctrl-");
-					addch(toupper(entry.shortcut));
-					addch(')');
+					while(len < (menuLen - 8)) { frameAddChar(frame, ' '); len++; }
+					frameAddStr(frame, "(Ctrl-", -1);
+					frameAddChar(frame, toupper(entry.shortcut));
+					frameAddChar(frame, ')');
 				}
 			} else {
-				while(len < menuLen) { addch(' '); len++; }
+				while(len < menuLen) { frameAddChar(frame, ' '); len++; }
 			}
-			if (grp->selected == i) { attron(A_REVERSE); }
-			addch('|');
+			if (grp->selected == i) { frameAttrOn(frame, A_REVERSE); }
+			frameAddChar(frame, '|');
 		}
 	}
-	move(i + NEO_HEADER, off);
+	frameMove(frame, i + NEO_HEADER, off);
 	menuPrintLn('|');
-	attroff(A_REVERSE);
+	frameAttrOff(frame, A_REVERSE);
+}
+
+static void editorLogKey(editorContext* ctx, int key) {
+	if (key != ERR && ctx->keyLog) {
+		fprintf(ctx->keyLog, "%" PRId64 " %d\n", editorClock() - ctx->keyLogStart, key);
+	}
+}
+
+static int64_t editorNextWake(editorContext* ctx) {
+	// Redraw once the status message expires, and regularly while pages are busy
+	int64_t now = editorClock();
+	int64_t wake = -1;
+	if (ctx->statusMsg[0] != '\0' && ctx->statusMsgTime + (NEO_STATUS_TIMEOUT * 1000) > now) {
+		wake = ctx->statusMsgTime + (NEO_STATUS_TIMEOUT * 1000);
+	}
+	if (editorIsBusy(ctx)) {
+		int64_t refresh = now + (NEO_BUSY_REFRESH * 1000);
+		wake = (wake < 0) ? refresh : MIN(wake, refresh);
+	}
+	return wake;
+}
+
+static void editorSetTimer(editorContext* ctx, int64_t deadline) {
+	if (ctx->timerFd < 0 || deadline == ctx->timerDeadline) { return; }
+
+	// A zeroed time disarms the timer
+	struct itimerspec spec = { 0 };
+	if (deadline >= 0) {
+		spec.it_value.tv_sec = deadline / 1000000;
+		spec.it_value.tv_nsec = (deadline % 1000000) * 1000;
+	}
+	if (timerfd_settime(ctx->timerFd, TFD_TIMER_ABSTIME, &spec, NULL) == 0) {
+		ctx->timerDeadline = deadline;
+	}
+}
+
+static void editorOnInput(void* data, int fd, uint32_t events) {
+	editorContext* ctx = (editorContext*)(data);
+	(void)(fd);
+
+	// ncurses reads a byte at a time, so nothing is left buffered once getch runs dry
+	int num = 0;
+	timeout(0);
+	for(int key = getch(); key != ERR; key = getch()) {
+		editorLogKey(ctx, key);
+		keyQueuePush(&ctx->input, key);
+		num++;
+	}
+	if (num == 0 && (events & (EPOLLHUP | EPOLLERR))) {
+		// The terminal went away
+		eventLoopRemove(&ctx->events, STDIN_FILENO);
+		editorAbort(ctx, 1);
+	}
+}
+
+static void editorOnSignal(void* data, int fd, uint32_t events) {
+	editorContext* ctx = (editorContext*)(data);
+	(void)(events);
+
+	struct signalfd_siginfo info;
+	while(read(fd, &info, sizeof(info)) == sizeof(info)) {
+		switch(info.ssi_signo) {
+			case SIGWINCH: {
+				cursesResize();
+				editorResize(ctx);
+			} break;
+			case SIGHUP:
+			case SIGTERM: {
+				// Swap files are left behind for whatever wasn't saved
+				editorAbort(ctx, 0);
+			} break;
+		}
+	}
+}
+
+static void editorOnTimer(void* data, int fd, uint32_t events) {
+	editorContext* ctx = (editorContext*)(data);
+	(void)(events);
+
+	// Waking up is all the timer is for; the caller redraws the screen
+	uint64_t expirations;
+	if (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+		ctx->timerDeadline = -1;
+	}
+}
+
+bool editorWatchTerminal(editorContext* ctx) {
+	if (!ctx || ctx->events.fd < 0 || ctx->signalFd >= 0) { return false; }
+
+	// Signals are read from a descriptor instead of interrupting whatever
+	// the editor is in the middle of
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGWINCH);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGHUP);
+	if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) { return false; }
+	ctx->signalFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (ctx->signalFd >= 0 && 
+		eventLoopAdd(&ctx->events, STDIN_FILENO, editorOnInput, ctx) && 
+		eventLoopAdd(&ctx->events, ctx->signalFd, editorOnSignal, ctx) && 
+		eventLoopAdd(&ctx->events, ctx->timerFd, editorOnTimer, ctx)) {
+		return true;
+	}
+
+	// Fall back to waiting in getch, with the signals delivered as usual
+	eventLoopRemove(&ctx->events, STDIN_FILENO);
+	eventLoopRemove(&ctx->events, ctx->signalFd);
+	eventLoopRemove(&ctx->events, ctx->timerFd);
+	if (ctx->signalFd >= 0) {
+		close(ctx->signalFd);
+		ctx->signalFd = -1;
+	}
+	sigprocmask(SIG_UNBLOCK, &mask, NULL);
+	return false;
+}
+
+int editorReadKey(editorContext* ctx, int delay) {
+	if (!ctx) { return ERR; }
+
+	int key = keyQueuePop(&ctx->input);
+	if (key != ERR || !ctx->frame.backend->terminal) { return key; }
+
+	// Without an event loop, getch has to wake up for the timers itself
+	int64_t wake = editorNextWake(ctx);
+	if (ctx->signalFd < 0) {
+		if (wake >= 0) {
+			int wakeDelay = (int)((wake - editorClock() + 999) / 1000);
+			delay = (delay < 0) ? wakeDelay : MIN(delay, wakeDelay);
+		}
+		timeout(delay);
+		key = getch();
+		editorLogKey(ctx, key);
+		return key;
+	}
+
+	// Otherwise sleep until there's input, a signal, or a timer goes off
+	editorSetTimer(ctx, wake);
+	eventLoopWait(&ctx->events, delay);
+	return keyQueuePop(&ctx->input);
+}
+
+void editorHandleKeys(editorContext* ctx, int key) {
+	if (!ctx) { return; }
+
+	int64_t deadline = editorClock() + ((int64_t)(ctx->settingInputBudget) * 1000);
+	while(key != ERR) {
+		editorHandleInput(ctx, key);
+		if (ctx->state == ES_SHOULD_CLOSE || editorClock() >= deadline) { break; }
+		key = editorReadKey(ctx, 0);
+	}
+}
+
+bool editorRecordKeys(editorContext* ctx, const char* filename) {
+	if (!ctx || !filename) { return false; }
+
+	FILE* fp = fopen(filename, "w");
+	if (!fp) { return false; }
+
+	// Flush every key, so the log survives the editor being killed
+	setvbuf(fp, NULL, _IOLBF, 0);
+	fprintf(fp, "# neo key log: <microseconds> <key code>\n");
+	fprintf(fp, "size %d %d\n", ctx->screenRows + NEO_HEADER + NEO_FOOTER, ctx->screenCols);
+	if (ctx->keyLog) { fclose(ctx->keyLog); }
+	ctx->keyLog = fp;
+	ctx->keyLogStart = editorClock();
+	return true;
+}
+
+bool editorLoadKeys(editorContext* ctx, const char* filename, int* rows, int* cols) {
+	if (!ctx || !filename) { return false; }
+
+	FILE* fp = fopen(filename, "r");
+	if (!fp) { return false; }
+
+	// Timestamps are only there for people reading the log
+	char line[64];
+	while(fgets(line, sizeof(line), fp)) {
+		int64_t time = 0;
+		int key = 0, height = 0, width = 0;
+		if (line[0] == '#') {
+			continue;
+		} else if (sscanf(line, "size %d %d", &height, &width) == 2) {
+			if (rows) { *rows = height; }
+			if (cols) { *cols = width; }
+		} else if (sscanf(line, "%" SCNd64 " %d", &time, &key) == 2) {
+			keyQueuePush(&ctx->input, key);
+		}
+	}
+	fclose(fp);
+	return true;
+}
+
+static bool editorCanEdit(editorContext* ctx, editorPage* page) {
+	// The first edit would start the swap file over, so what's left in it is dealt with first
+	if (page->recovery) {
+		editorRecoverPage(ctx, page);
+	}
+
+	// Pages being saved can still be edited, since the save works from a snapshot
+	if (PAGE_FLAG_ISSET(page, EF_LOADING)) {
+		editorSetMessage(ctx, "File is still loading!");
+		return false;
+	}
+	if (PAGE_FLAG_ISSET(page, EF_READONLY)) {
+		editorSetMessage(ctx, "File is in read-only mode!");
+		return false;
+	}
+	return true;
 }
 
 void editorHandleInput(editorContext* ctx, int key) {
@@ -1015,6 +5641,14 @@ void editorHandleInput(editorContext* ctx, int key) {
 				case KEY_END: {
 					pageSetCursorCol(currPage, -1);
 				} break;
+				case NEO_KEY_CTRL_HOME: {
+					pageGotoLine(ctx, currPage, 0);
+				} break;
+				case NEO_KEY_CTRL_END: {
+					if (pageGotoLine(ctx, currPage, MAX((int64_t)0, pageGetLineCount(currPage) - 1))) {
+						pageSetCursorCol(currPage, -1);
+					}
+				} break;
 				case KEY_SLEFT: {
 					editorSetMessage(ctx, "Shift-Left");
 				} break;
@@ -1060,6 +5694,14 @@ void editorHandleInput(editorContext* ctx, int key) {
 					}
 				} break;
 				case CTRL_KEY('b'): {
+					if (PAGE_FLAG_ISSET(currPage, EF_LOADING)) {
+						editorSetMessage(ctx, "File is still loading!");
+						break;
+					}
+					if (currPage->job) {
+						editorSetMessage(ctx, "File is already being saved!");
+						break;
+					}
 					pageSetFullFilename(currPage, NULL);
 					if (PAGE_FLAG_ISCLEAR(currPage, EF_READONLY)) {
 						PAGE_FLAG_SET(currPage, EF_DIRTY);
@@ -1067,10 +5709,7 @@ void editorHandleInput(editorContext* ctx, int key) {
 					pageSave(ctx, currPage);
 				} break;
 				case CTRL_KEY('d'): {
-					for(int pageIdx=0; pageIdx<ctx->numPages; ++pageIdx) {
-						editorPage* page = &ctx->pages[pageIdx];
-						pageSave(ctx, page);
-					}
+					editorSaveAll(ctx);
 				} break;
 				case CTRL_KEY('s'): {
 					pageSave(ctx, currPage);
@@ -1092,6 +5731,16 @@ void editorHandleInput(editorContext* ctx, int key) {
 						strbufClear(&input);
 					}
 				} break;
+				case CTRL_KEY('z'): {
+					if (editorCanEdit(ctx, currPage) && !pageUndo(currPage)) {
+						editorSetMessage(ctx, "Nothing to undo!");
+					}
+				} break;
+				case CTRL_KEY('y'): {
+					if (editorCanEdit(ctx, currPage) && !pageRedo(currPage)) {
+						editorSetMessage(ctx, "Nothing to redo!");
+					}
+				} break;
 				case CTRL_KEY('c'): {
 					editorSetMessage(ctx, "Copy");
 				} break;
@@ -1104,86 +5753,157 @@ void editorHandleInput(editorContext* ctx, int key) {
 				case CTRL_KEY('a'): {
 					editorSetMessage(ctx, "Select All");
 				} break;
+				case CTRL_KEY('g'): {
+					strbuf input;
+					editorPrompt(ctx, &input, "Go to line (or @byte offset): %s");
+					if (input.data) {
+						// Byte offsets start from 0, line numbers from 1
+						char* end = NULL;
+						bool offset = (input.data[0] == '@');
+						long long num = strtoll(&input.data[offset ? 1 : 0], &end, 10);
+						if (!end || *end != '\0' || num < (offset ? 0 : 1)) {
+							editorSetMessage(ctx, "Invalid %s (%s)!", offset ? "offset" : "line", input.data);
+						} else if (offset ? !pageGotoOffset(ctx, currPage, num) : !pageGotoLine(ctx, currPage, num - 1)) {
+							editorSetMessage(ctx, "File hasn't been indexed that far yet!");
+						}
+						strbufClear(&input);
+					}
+				} break;
 				case CTRL_KEY('f'): { ctx->state = ES_MENU; ctx->currMenu = 0; } break;
 				case CTRL_KEY('e'): { ctx->state = ES_MENU; ctx->currMenu = 1; } break;
 				case CTRL_KEY('h'): { ctx->state = ES_MENU; ctx->currMenu = 2; } break;
 				case KEY_BACKSPACE: {
-					if (PAGE_FLAG_ISSET(currPage, EF_READONLY)) { 
-						editorSetMessage(ctx, "File is in read-only mode!");
-						break; 
-					}
-					if (currRow) {
-						if (currPage->cx == 0 && currPage->cy > 0) {
-							// Merge text with previous line
-							editorRow* lastRow = &currPage->rows[currPage->cy - 1];
-							strbuf temp;
-							strbufInit(&temp, currRow->text.size + 1);
-							strbufAppend(&temp, currRow->text.data, currRow->text.size);
-							pageDeleteRow(currPage, currPage->cy);
-							rowInsert(lastRow, -1, temp.data, temp.size);
-							pageMoveCursor(ctx, currPage, ED_UP, 1);
-							pageSetCursorCol(currPage, lastRow->text.size - temp.size);
-							strbufClear(&temp);
-						} else {
-							pageMoveCursor(ctx, currPage, ED_LEFT, 1);
-							rowDelete(currRow, currPage->cx, 1);
-						}
+					if (!editorCanEdit(ctx, currPage)) { break; }
+					currRow = PAGE_CURR_ROW(currPage);
+					if (!currRow) { break; }
+					if (currPage->cx == 0 && currPage->cy > 0) {
+						// Merge text with previous line, which marks the page modified as the row goes
+						editorRow* lastRow = pageEditRow(currPage, currPage->cy - 1);
+						if (!lastRow) { break; }
+						currRow = PAGE_CURR_ROW(currPage);
+						unsigned int lastLen = lastRow->size;
+						rowCopy(lastRow, -1, currRow, 0, -1);
+						if (lastRow->size != lastLen + currRow->size) { break; }
+						pageDeleteRow(currPage, currPage->cy);
+						pageMeasureRow(currPage, currPage->cy - 1);
+						pageRecordEdit(currPage, UK_DELETE, currPage->cy - 1, lastLen, "\n", 1, currPage->cx, currPage->cy);
+						pageMoveCursor(ctx, currPage, ED_UP, 1);
+						pageSetCursorCol(currPage, lastLen);
+					} else if (currPage->cx > 0) {
+						currRow = pageEditRow(currPage, currPage->cy);
+						if (!currRow) { break; }
+						char text = rowGetChar(currRow, currPage->cx - 1);
+						unsigned int size = currRow->size;
+						rowDelete(currRow, currPage->cx - 1, 1);
+						if (currRow->size == size) { break; }
+						pageMeasureRow(currPage, currPage->cy);
+						pageRecordEdit(currPage, UK_DELETE, currPage->cy, currPage->cx - 1, &text, 1, currPage->cx, currPage->cy);
+						pageMoveCursor(ctx, currPage, ED_LEFT, 1);
+						PAGE_FLAG_SET(currPage, EF_DIRTY);
 					}
 				} break;
 				case KEY_DC: {
-					if (PAGE_FLAG_ISSET(currPage, EF_READONLY)) { 
-						editorSetMessage(ctx, "File is in read-only mode!");
-						break; 
-					}
-					if (currRow) {
-						if (currPage->cx == (int)currRow->text.size && currPage->cy < currPage->numRows - 1) {
-							// Bring next line onto current line
-							editorRow* nextRow = &currPage->rows[currPage->cy + 1];
-							strbuf temp;
-							strbufInit(&temp, nextRow->text.size + 1);
-							strbufAppend(&temp, nextRow->text.data, nextRow->text.size);
-							pageDeleteRow(currPage, currPage->cy + 1);
-							rowInsert(currRow, -1, temp.data, temp.size);
-							strbufClear(&temp);
-						} else if (currPage->cx < (int)currRow->text.size) {
-							rowDelete(currRow, currPage->cx, 1);
-						}
+					if (!editorCanEdit(ctx, currPage)) { break; }
+					currRow = PAGE_CURR_ROW(currPage);
+					if (!currRow) { break; }
+					if (currPage->cx == (int)currRow->size && currPage->cy < currPage->numRows - 1) {
+						// Bring next line onto current line, which marks the page modified as the row goes
+						currRow = pageEditRow(currPage, currPage->cy);
+						if (!currRow) { break; }
+						editorRow* nextRow = pageGetRow(currPage, currPage->cy + 1);
+						rowCopy(currRow, -1, nextRow, 0, -1);
+						if (currRow->size != (unsigned int)(currPage->cx) + nextRow->size) { break; }
+						pageDeleteRow(currPage, currPage->cy + 1);
+						pageMeasureRow(currPage, currPage->cy);
+						pageRecordEdit(currPage, UK_DELETE, currPage->cy, currPage->cx, "\n", 1, currPage->cx, currPage->cy);
+					} else if (currPage->cx < (int)currRow->size) {
+						currRow = pageEditRow(currPage, currPage->cy);
+						if (!currRow) { break; }
+						char text = rowGetChar(currRow, currPage->cx);
+						unsigned int size = currRow->size;
+						rowDelete(currRow, currPage->cx, 1);
+						if (currRow->size == size) { break; }
+						pageMeasureRow(currPage, currPage->cy);
+						pageRecordEdit(currPage, UK_DELETE, currPage->cy, currPage->cx, &text, 1, currPage->cx, currPage->cy);
+						PAGE_FLAG_SET(currPage, EF_DIRTY);
 					}
 				} break;
 				case '\n':
 				case '\r':
 				case KEY_ENTER: {
-					if (PAGE_FLAG_ISSET(currPage, EF_READONLY)) { 
-						editorSetMessage(ctx, "File is in read-only mode!");
-						break; 
-					}
+					if (!editorCanEdit(ctx, currPage)) { break; }
 					if (currRow) {
 						// Split text onto a new line
-						strbuf temp;
-						strbufInit(&temp, currRow->text.size + 1);
-						strbufAppend(&temp, &currRow->text.data[currPage->cx], currRow->text.size - (unsigned int)currPage->cx);
-						rowDelete(currRow, currPage->cx, (int)currRow->text.size - currPage->cx);
-						pageInsertRow(currPage, currPage->cy + 1, temp.data, temp.size);
+						editorRow* nextRow = pageInsertRow(currPage, currPage->cy + 1, "", 0);
+						currRow = pageEditRow(currPage, currPage->cy);
+						if (!nextRow || !currRow) { break; }
+						pageRecordEdit(currPage, UK_INSERT, currPage->cy, currPage->cx, "\n", 1, currPage->cx, currPage->cy);
+						if (currPage->cx < (int)currRow->size) {
+							rowCopy(nextRow, 0, currRow, currPage->cx, -1);
+							rowDelete(currRow, currPage->cx, -1);
+							pageMeasureRow(currPage, currPage->cy);
+							pageMeasureRow(currPage, currPage->cy + 1);
+						}
 						pageSetCursorCol(currPage, 0);
 						pageMoveCursor(ctx, currPage, ED_DOWN, 1);
-						strbufClear(&temp);
 					} else {
-						pageInsertRow(currPage, -1, "", 0);
+						if (!pageInsertRow(currPage, -1, "", 0)) { break; }
+						pageRecordNewRow(currPage, currPage->numRows - 2, currPage->cx, currPage->cy);
 						pageMoveCursor(ctx, currPage, ED_DOWN, 1);
 					}
 				} break;
-				default: {
-					if (PAGE_FLAG_ISSET(currPage, EF_READONLY)) { 
-						editorSetMessage(ctx, "File is in read-only mode!");
-						break; 
+				case NEO_KEY_PASTE_START: {
+					// Gather the whole paste, then insert it as one block
+					strbuf paste;
+					strbufInit(&paste, 4096);
+					for(int c = editorReadKey(ctx, NEO_PASTE_TIMEOUT); c != ERR && c != NEO_KEY_PASTE_END; c = editorReadKey(ctx, NEO_PASTE_TIMEOUT)) {
+						if (c == '\r' || c == '\n' || c == KEY_ENTER) {
+							strbufAppend(&paste, "\n", 1);
+						} else if ((!iscntrl(c) && c < 128 && c >= 0) || c == '\t') {
+							char text = (char)(c);
+							strbufAppend(&paste, &text, 1);
+						}
+					}
+					int cx = currPage->cx;
+					int cy = currPage->cy;
+					int numRows = currPage->numRows;
+					if (editorCanEdit(ctx, currPage) && paste.size > 0) {
+						// Nothing is recorded until the text is in, since a failed paste leaves the page as it was
+						if (pageInsertText(currPage, paste.data, paste.size)) {
+							if (cy >= numRows) {
+								pageRecordNewRow(currPage, numRows - 1, cx, cy);
+							}
+
+							// Pastes are undone on their own, never with the typing around them
+							undoJournalSeal(&currPage->undo);
+							pageRecordEdit(currPage, UK_INSERT, cy, cx, paste.data, paste.size, cx, cy);
+							undoJournalSeal(&currPage->undo);
+						} else {
+							editorSetMessage(ctx, "Failed to paste text!");
+						}
 					}
+					strbufClear(&paste);
+				} break;
+				default: {
+					if (!editorCanEdit(ctx, currPage)) { break; }
 					if ((!iscntrl(key) && key < 128 && key >= 0) || key == '\t') {
-						if (!currRow) {
+						if (currRow) {
+							currRow = pageEditRow(currPage, currPage->cy);
+						} else {
 							currRow = pageInsertRow(currPage, -1, "", 0);
+							if (currRow) {
+								pageRecordNewRow(currPage, currPage->numRows - 2, currPage->cx, currPage->cy);
+							}
 						}
+						if (!currRow) { break; }
 						char text = (char)(key);
+						unsigned int size = currRow->size;
 						rowInsert(currRow, currPage->cx, &text, 1);
+						if (currRow->size == size) { break; }
+						pageMeasureRow(currPage, currPage->cy);
+						pageRecordEdit(currPage, UK_INSERT, currPage->cy, currPage->cx, &text, 1, currPage->cx, currPage->cy);
 						pageMoveCursor(ctx, currPage, ED_RIGHT, 1);
+						PAGE_FLAG_SET(currPage, EF_DIRTY);
 					}
 				} break;
 			}
@@ -1270,6 +5990,70 @@ void editorHandleInput(editorContext* ctx, int key) {
 	}
 }
 
+/// @brief A file being read on a worker thread. It's loaded into a page of its
+/// @brief own, which is handed over to the real one once it's finished.
+typedef struct {
+	editorContext* ctx;
+	editorPage page;
+	char* filename;
+	bool opened;
+	bool failed;
+} pageLoadJob;
+
+static void pageLoadRun(workerJob* job) {
+	pageLoadJob* load = (pageLoadJob*)(job->data);
+
+	FILE* fp = fopen(load->filename, "r");
+	if (!fp) { return; }
+	load->opened = true;
+	load->failed = !pageLoad(load->ctx, &load->page, fp);
+	fclose(fp);
+	if (!load->failed) {
+		pageLoadJournals(&load->page, load->filename);
+	}
+}
+
+static void pageLoadDone(workerJob* job) {
+	pageLoadJob* load = (pageLoadJob*)(job->data);
+	editorContext* ctx = load->ctx;
+
+	// Move the text into whichever page the job belongs to now. Files that
+	// couldn't be opened are left as blank pages with the file's name
+	editorPage* loaded = &load->page;
+	for(int i=0; i<ctx->numPages; ++i) {
+		editorPage* page = &ctx->pages[i];
+		if (page->job != job) { continue; }
+		page->job = NULL;
+		PAGE_FLAG_CLEAR(page, EF_LOADING);
+		page->rows = loaded->rows;
+		page->numRows = loaded->numRows;
+		page->text = loaded->text;
+		page->huge = loaded->huge;
+		page->undo = loaded->undo;
+		page->savedHash = loaded->savedHash;
+		page->savedSize = loaded->savedSize;
+		page->recovery = loaded->recovery;
+		page->flags |= loaded->flags;
+		if (!load->failed) {
+			pageAttachSwap(ctx, page, load->filename);
+		}
+		if (PAGE_FLAG_ISSET(page, EF_NOSWAP)) {
+			editorSetMessage(ctx, "File is open in another editor (%s)!", page->filename);
+		}
+		loaded = NULL;
+		break;
+	}
+	if (loaded) {
+		pageClear(loaded);
+	}
+	if (load->failed) {
+		editorSetMessage(ctx, "Failed to read file (%s)!", load->filename);
+	}
+	free(load->filename);
+	free(load);
+	free(job);
+}
+
 editorPage* editorOpenPage(editorContext* ctx, char* filename, int internal) {
 	if (!ctx) { return NULL; }
 	
@@ -1284,6 +6068,8 @@ editorPage* editorOpenPage(editorContext* ctx, char* filename, int internal) {
 		ctx->numPages++;
 		editorPage* page = EDITOR_CURR_PAGE(ctx);
 		pageInit(page);
+		page->undo.limit = ctx->settingUndoLimit;
+		page->tabStop = ctx->settingTabStop;
 		return page;
 	} else {
 		// Check if file is valid
@@ -1314,26 +6100,119 @@ editorPage* editorOpenPage(editorContext* ctx, char* filename, int internal) {
 		ctx->numPages++;
 		editorPage* page = EDITOR_CURR_PAGE(ctx);
 		pageInit(page);
+		page->undo.limit = ctx->settingUndoLimit;
+		page->tabStop = ctx->settingTabStop;
 		pageSetFullFilename(page, filename);
 
 		// Populate page with file contents
-		char* line = NULL;
-		size_t n = 0;
-		ssize_t linelen;
-		while((linelen = getline(&line, &n, fp)) != -1) {
-			// Trim newlines
-			while(linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r')) {
-				linelen--;
-			}
-			pageInsertRow(page, -1, line, linelen);
+		if (!pageLoad(ctx, page, fp)) {
+			editorSetMessage(ctx, "Failed to read file (%s)!", filename);
+		} else if (!(pageFlags & EF_READONLY)) {
+			pageLoadJournals(page, filename);
+			pageAttachSwap(ctx, page, filename);
 		}
-		free(line);
 		fclose(fp);
-		page->flags = pageFlags;
+		page->flags |= pageFlags;
+		if (PAGE_FLAG_ISSET(page, EF_NOSWAP)) {
+			editorSetMessage(ctx, "File is open in another editor (%s)!", page->filename);
+		}
+		editorRecoverPage(ctx, page);
 		return page;
 	}
 }
 
+editorPage* editorLoadPage(editorContext* ctx, char* filename) {
+	if (!ctx || !filename) { return NULL; }
+
+	workerJob* job = calloc(1, sizeof(*job));
+	pageLoadJob* load = calloc(1, sizeof(*load));
+	char* name = strdup(filename);
+	editorPage* page = (job && load && name) ? editorOpenPage(ctx, NULL, -1) : NULL;
+	if (!page) {
+		free(job);
+		free(load);
+		free(name);
+		return NULL;
+	}
+	pageSetFullFilename(page, filename);
+	PAGE_FLAG_SET(page, EF_LOADING);
+
+	// Hand the read off to a worker
+	load->ctx = ctx;
+	pageInit(&load->page);
+	load->page.undo.limit = ctx->settingUndoLimit;
+	load->page.tabStop = ctx->settingTabStop;
+	load->filename = name;
+	job->run = pageLoadRun;
+	job->done = pageLoadDone;
+	job->data = load;
+	page->job = job;
+	if (!workerPoolSubmit(&ctx->workers, job)) {
+		// Without a thread to run on, load on this one
+		pageLoadRun(job);
+		pageLoadDone(job);
+	}
+	return EDITOR_CURR_PAGE(ctx);
+}
+
+void editorWaitPage(editorContext* ctx, editorPage* page) {
+	if (!ctx || !page || !page->job) { return; }
+
+	workerPoolWait(&ctx->workers, page->job);
+	workerPoolCollect(&ctx->workers);
+}
+
+void editorRecoverPage(editorContext* ctx, editorPage* page) {
+	if (!ctx || !page || !page->recovery) { return; }
+
+	// Only ask once, even if the answer is to leave it for later
+	swapRecovery* recovery = page->recovery;
+	page->recovery = NULL;
+	pageUpdate(ctx, page);
+	char prompt[80];
+	snprintf(prompt, sizeof(prompt), "Found %d unsaved edit%s! (r=Recover / d=Discard / k=Keep): %%s", recovery->numOps, (recovery->numOps == 1) ? "" : "s");
+	char choice = '\0';
+	while(!choice) {
+		strbuf input;
+		editorPrompt(ctx, &input, prompt);
+		if (!input.data || input.size == 0) {
+			// Cancelling leaves the swap file for next time
+			choice = 'k';
+		} else {
+			STR_TOLOWER(input.data);
+			if (strcmp(input.data, "r") == 0 || strcmp(input.data, "d") == 0 || strcmp(input.data, "k") == 0) {
+				choice = input.data[0];
+			}
+		}
+		strbufClear(&input);
+	}
+
+	bool keep = (choice == 'k');
+	if (choice == 'r') {
+		// Carry on from the end of the swap file, unless it doesn't fit the page any more
+		int numReplayed = pageReplaySwap(page, recovery);
+		if (numReplayed == recovery->numOps) {
+			swapFileResume(page->swap, recovery);
+			editorSetMessage(ctx, "Recovered %d edit%s!", numReplayed, (numReplayed == 1) ? "" : "s");
+		} else {
+			keep = true;
+			editorSetMessage(ctx, "Only recovered %d of %d edits!", numReplayed, recovery->numOps);
+		}
+	} else if (choice == 'd') {
+		unlink(recovery->path);
+	} else {
+		editorSetMessage(ctx, "Kept the swap file, new edits won't be recoverable!");
+	}
+	if (keep) {
+		// New edits would start the swap file over, so they aren't written to one
+		PAGE_FLAG_SET(page, EF_NOSWAP);
+		swapFileClose(page->swap, false);
+		page->swap = NULL;
+	}
+	swapRecoveryClear(recovery);
+	free(recovery);
+}
+
 void editorSetPage(editorContext* ctx, int at) {
 	if (!ctx || at >= ctx->numPages) { return; }
 	
@@ -1351,7 +6230,7 @@ int editorSetMessage(editorContext* ctx, const char* fmt, ...) {
 	va_start(ap, fmt);
 	vsnprintf(&ctx->statusMsg[0], msgLen, fmt, ap);
 	va_end(ap);
-	ctx->statusMsgTime = time(NULL);
+	ctx->statusMsgTime = editorClock();
 	return msgLen;
 }
 
@@ -1369,10 +6248,17 @@ void editorClosePage(editorContext* ctx, int at, bool save) {
 			pageSave(ctx, page);
 		}
 
+		// The rows can't be freed while a worker is still using them
+		editorWaitPage(ctx, page);
+
+		// Unsaved edits are thrown away with the page, unless they were meant to be saved and couldn't be
+		swapFileClose(page->swap, PAGE_FLAG_ISCLEAR(page, EF_DIRTY) || !save);
+		page->swap = NULL;
+
 		// Close page
 		pageClear(page);
 		if (at < ctx->numPages - 1) {
-			memmove(&ctx->pages[at], &ctx->pages[at + 1], (ctx->numPages - at) * sizeof(*ctx->pages));
+			memmove(&ctx->pages[at], &ctx->pages[at + 1], (ctx->numPages - at - 1) * sizeof(*ctx->pages));
 		}
 		ctx->numPages--;
 		if (ctx->currPage >= ctx->numPages) {
@@ -1381,9 +6267,83 @@ void editorClosePage(editorContext* ctx, int at, bool save) {
 	}
 }
 
+static void editorWaitSaves(editorContext* ctx) {
+	// Keep drawing while the saves run, so their progress shows
+	while(1) {
+		bool saving = false;
+		for(int i=0; i<ctx->numPages && !saving; ++i) {
+			saving = (ctx->pages[i].job != NULL);
+		}
+		if (!saving) { return; }
+		editorUpdate(ctx);
+		editorPrint(ctx);
+		if (eventLoopWait(&ctx->events, NEO_BUSY_REFRESH) < 0) {
+			editorWaitJobs(ctx);
+		}
+	}
+}
+
+bool editorSaveAll(editorContext* ctx) {
+	if (!ctx) { return false; }
+
+	while(1) {
+		// Start the pages that already have names first, so they're written
+		// while new pages are being named
+		editorWaitSaves(ctx);
+		int numPending = 0;
+		for(int i=0; i<ctx->numPages; ++i) {
+			editorPage* page = &ctx->pages[i];
+			numPending += (PAGE_FLAG_ISSET(page, EF_DIRTY) && PAGE_FLAG_ISCLEAR(page, EF_READONLY)) ? 1 : 0;
+		}
+		if (numPending == 0) { return true; }
+		for(int named=1; named>=0; --named) {
+			for(int i=0; i<ctx->numPages; ++i) {
+				editorPage* page = &ctx->pages[i];
+				if (PAGE_FLAG_ISCLEAR(page, EF_DIRTY) || PAGE_FLAG_ISSET(page, EF_READONLY)) { continue; }
+				if ((page->filename != NULL) != named || !pageSaveName(ctx, page)) { continue; }
+				pageSaveStart(ctx, page);
+			}
+		}
+		editorWaitSaves(ctx);
+
+		// Anything still modified couldn't be opened or written
+		int numFailed = 0;
+		for(int i=0; i<ctx->numPages; ++i) {
+			editorPage* page = &ctx->pages[i];
+			numFailed += (PAGE_FLAG_ISSET(page, EF_DIRTY) && PAGE_FLAG_ISCLEAR(page, EF_READONLY)) ? 1 : 0;
+		}
+		int numSaved = numPending - numFailed;
+		if (numFailed == 0) {
+			editorSetMessage(ctx, "Saved %d file%s!", numSaved, (numSaved == 1) ? "" : "s");
+			return true;
+		}
+
+		// Ask what to do about the ones that failed, all at once
+		char prompt[80];
+		snprintf(prompt, sizeof(prompt), "Failed to save %d file%s! (r=Retry / c=Cancel): %%s", numFailed, (numFailed == 1) ? "" : "s");
+		while(1) {
+			strbuf inputError;
+			editorPrompt(ctx, &inputError, prompt);
+			if (!inputError.data || inputError.size == 0) {
+				strbufClear(&inputError);
+				return false;
+			}
+			STR_TOLOWER(inputError.data);
+			bool retry = (strcmp(inputError.data, "r") == 0);
+			bool cancel = (strcmp(inputError.data, "c") == 0);
+			strbufClear(&inputError);
+			if (cancel) { return false; }
+			if (retry) { break; }
+		}
+	}
+}
+
 bool editorCloseAll(editorContext* ctx) {
 	if (!ctx) { return false; }
 
+	// Let saves in flight finish first, since a failed one leaves its page unsaved
+	editorWaitJobs(ctx);
+
 	// Check for unsaved files
 	bool save = false;
 	for(int i=0; i<ctx->numPages; ++i) {
@@ -1408,7 +6368,8 @@ bool editorCloseAll(editorContext* ctx) {
 					save = false;
 					strbufClear(&input);
 					break;
-				} else if (strcmp(input.data, "c") == 0) {
+				} else if (input.size == 0 || strcmp(input.data, "c") == 0) {
+					// Cancelling the prompt leaves it empty
 					strbufClear(&input);
 					return false;
 				}
@@ -1420,9 +6381,12 @@ bool editorCloseAll(editorContext* ctx) {
 		}
 	}
 
+	// Save everything together, staying open if some of it couldn't be
+	if (save && !editorSaveAll(ctx)) { return false; }
+
 	// Close pages
 	while(ctx->numPages > 0) {
-		editorClosePage(ctx, 0, save);
+		editorClosePage(ctx, 0, false);
 	}
 	return true;
 }
@@ -1431,17 +6395,32 @@ void editorPrompt(editorContext* ctx, strbuf* buf, const char* prompt) {
 	strbufInit(buf, 1);
 	if (!ctx) { return; }
 
+	// Nobody is left to answer once the editor has been told to close
+	if (ctx->state == ES_SHOULD_CLOSE) {
+		strbufClear(buf);
+		return;
+	}
+
 	int lastState = ctx->state;
 	ctx->state = ES_PROMPT;
 	while(1) {
 		// Update editor state
 		editorSetMessage(ctx, prompt, buf->data);
 		editorPrint(ctx);
-		refresh();
 		
-		// Get input
-		int c = getch();
-		if (c == KEY_DC || c == KEY_BACKSPACE || c == CTRL_KEY('h')) {
+		// Get input, giving up once a headless run has nothing left to say
+		int c = editorReadKey(ctx, -1);
+		if (c == ERR && !ctx->frame.backend->terminal) {
+			c = CTRL_KEY('q');
+		}
+		if (ctx->state == ES_SHOULD_CLOSE) {
+			// A signal or a lost terminal cancels the prompt, and the close goes ahead
+			editorSetMessage(ctx, "");
+			strbufClear(buf);
+			return;
+		} else if (c == ERR) {
+			continue;
+		} else if (c == KEY_DC || c == KEY_BACKSPACE || c == CTRL_KEY('h')) {
 			strbufDelChar(buf);
 		} else if (c == CTRL_KEY('q') || c == CTRL_KEY('c')) {
 			editorSetMessage(ctx, "");
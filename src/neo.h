@@ -26,6 +26,21 @@
 #include <ctype.h>
 #include <assert.h>
 #include <argp.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <pthread.h>
 
 
 // ============================================== defines
@@ -33,10 +48,51 @@
 #define NEO_HEADER 2
 #define NEO_FOOTER 2
 #define NEO_SCROLL_MARGIN 1
+#define NEO_BUSY_REFRESH 250
+#define NEO_STATUS_TIMEOUT 5000
+#define NEO_MAX_EVENTS 16
+#define NEO_RENDER_MARGIN 16
+#define NEO_INPUT_BUDGET 50
+#define NEO_PASTE_TIMEOUT 1000
+#define NEO_TAB_STOP 4
+#define NEO_KEY_CTRL_HOME (KEY_MAX + 1)
+#define NEO_KEY_CTRL_END (KEY_MAX + 2)
+#define NEO_KEY_PASTE_START (KEY_MAX + 3)
+#define NEO_KEY_PASTE_END (KEY_MAX + 4)
+#define ROW_BLOCK_SIZE 64
+#define ROW_TREE_ORDER 32
+#define LOAD_CHUNK_MIN_SIZE (1024 * 1024)
+#define LOAD_MAX_THREADS 16
+#define LOAD_SCAN_BLOCK (64 * 1024)
+#define HUGE_FILE_MIN_SIZE (1024LL * 1024 * 1024)
+#define HUGE_CHECKPOINT_LINES 1024
+#define HUGE_WINDOW_ROWS 4096
+#define HUGE_WINDOW_MAX_SIZE (64 * 1024 * 1024)
+#define WORKER_MAX_THREADS 8
+#define SAVE_PROGRESS_ROWS 4096
+#define SAVE_MAX_SPANS 1024
+#define SAVE_SYNC true
+#define UNDO_MAX_SIZE (64 * 1024 * 1024)
+#define UNDO_MERGE_MAX 256
+#define UNDO_BATCH_SIZE (256 * 1024)
+#define UNDO_MAX_SPANS 1024
+#define UNDO_FILE_MAGIC "NEOUNDO1"
+#define SWAP_COMMIT_DELAY 200
+#define SWAP_BUFFER_SIZE (256 * 1024)
+#define SWAP_FILE_MAGIC "NEOSWAP1"
 
 enum editorFlag {
 	EF_DIRTY =    0x01,		// File has been modified and should be saved before closing.
-	EF_READONLY = 0x02		// File is marked as read-only and cannot be modified or saved.
+	EF_READONLY = 0x02,		// File is marked as read-only and cannot be modified or saved.
+	EF_CRLF =     0x04,		// File uses CRLF line endings and should be saved with them.
+	EF_LOADING =  0x08,		// File is still being read on a worker thread and cannot be modified yet.
+	EF_NOSWAP =   0x10,		// File's edits are not written to a swap file, since another one is still in use.
+	EF_CHANGED =  0x20		// File was changed on disk while mapped, so some of its text may be wrong.
+};
+
+enum undoKind {
+	UK_INSERT = 1,			// Text was inserted at the position, and is deleted again to undo it.
+	UK_DELETE				// Text was deleted from the position, and is inserted again to undo it.
 };
 
 enum editorState {
@@ -67,11 +123,11 @@ extern const char* argp_program_bug_address;
 /// @brief Initialize ncurses library.
 void cursesInit();
 
-/// @brief General signal handler.
-/// @param sig Signal id
-void signalHandler(int sig);
+/// @brief Restore the terminal after cursesInit.
+void cursesEnd();
 
-extern bool _neo_flag_resized;
+/// @brief Resize ncurses to the terminal's current size.
+void cursesResize();
 
 
 // ============================================== context menus
@@ -116,13 +172,25 @@ void menuGroupDelete(menuGroup* grp, int at);
 
 // ============================================== text buffers
 
-/// @brief Dynamically resizing null-terminated text buffer.
+/// @brief Dynamically resizing null-terminated text buffer. The gap functions
+/// @brief switch it to gap buffer mode, where the unused capacity sits in the
+/// @brief middle of the text (at gap, gapLen bytes long) so repeated edits at
+/// @brief the same spot don't move the rest of the text. Any other function
+/// @brief compacts the buffer back to a null-terminated string first.
 typedef struct {
 	char* data;
 	unsigned int size;
 	unsigned int capacity;
+	unsigned int gap;
+	unsigned int gapLen;
 } strbuf;
 
+/// @brief Span of text stored in a buffer owned by someone else.
+typedef struct {
+	const char* data;
+	unsigned int len;
+} textPiece;
+
 /// @brief Initialize a string buffer structure.
 /// @param buf String buffer pointer
 /// @param capacity Initial buffer capacity
@@ -183,27 +251,859 @@ void strbufGrow(strbuf* buf, unsigned int min_size);
 /// @return String length
 int strbufLength(strbuf* buf);
 
+/// @brief Insert text into the string buffer by moving the gap to the insertion point.
+/// @param buf String buffer pointer
+/// @param str String to insert
+/// @param len String length
+/// @param at Starting position in buffer
+void strbufGapInsert(strbuf* buf, const char* str, unsigned int len, unsigned int at);
+
+/// @brief Remove text from the string buffer by moving the gap to it and widening the gap.
+/// @param buf String buffer pointer
+/// @param at Starting position
+/// @param len Number of characters to remove
+void strbufGapDelete(strbuf* buf, unsigned int at, unsigned int len);
+
+/// @brief Get the text before and after the gap without compacting the buffer.
+/// @param buf String buffer pointer
+/// @param spans Destination for the two spans (the second one is empty when there is no gap)
+void strbufGetSpans(strbuf* buf, textPiece spans[2]);
+
+/// @brief Close the gap so the buffer holds a single null-terminated string.
+/// @param buf String buffer pointer
+/// @return Pointer to the text
+char* strbufCompact(strbuf* buf);
+
+
+// ============================================== piece tables
+
+#define PIECE_BLOCK_SIZE 4096
+#define PIECE_MMAP_MIN_SIZE (64 * 1024)
+#define PIECE_DETACH_SIZE (1024 * 1024)
+#define PIECE_MAX_MAPPED 64
+
+/// @brief Block of a piece table's append buffer. Blocks are never resized,
+/// @brief so pieces can point directly into them.
+typedef struct pieceBlock {
+	struct pieceBlock* next;
+	size_t size;
+	size_t capacity;
+	char data[];
+} pieceBlock;
+
+/// @brief Text storage for a page. The original buffer holds the file as it
+/// @brief was loaded and is never modified; all text added afterwards goes in
+/// @brief the append buffer. Large regular files are memory mapped instead of
+/// @brief read, and the file is kept open to notice other programs changing it.
+typedef struct {
+	char* original;
+	size_t originalSize;
+	pieceBlock* append;
+	bool mapped;
+	int fd;
+	struct timespec mtime;
+} pieceTable;
+
+/// @brief Initialize a piece table structure.
+/// @param table Piece table pointer
+void pieceTableInit(pieceTable* table);
+
+/// @brief Free all memory associated with the piece table.
+/// @param table Piece table pointer
+void pieceTableClear(pieceTable* table);
+
+/// @brief Load the entire contents of a file into the original buffer. Regular
+/// @brief files are mapped read-only; pipes, internal documents and small files
+/// @brief are read into memory. Parts of a mapped file that are truncated away
+/// @brief by another program read back as zeros instead of crashing the editor.
+/// @param table Piece table pointer
+/// @param fp File pointer
+/// @return True on success
+bool pieceTableLoad(pieceTable* table, FILE* fp);
+
+/// @brief Check whether a mapped file has been changed on disk since it was
+/// @brief loaded, which changes the original buffer along with it.
+/// @param table Piece table pointer
+/// @return True if the file's size or modification time changed
+bool pieceTableChanged(pieceTable* table);
+
+/// @brief Copy a mapped original buffer out of its file, so the file can be
+/// @brief written over without changing the text. The buffer stays at the
+/// @brief same address.
+/// @param table Piece table pointer
+/// @return True on success, or if the buffer wasn't mapped
+bool pieceTableDetach(pieceTable* table);
+
+/// @brief Copy text to the end of the append buffer.
+/// @param table Piece table pointer
+/// @param str String to append
+/// @param len String length
+/// @return Stable pointer to the copied text (or NULL on error)
+const char* pieceTableAppend(pieceTable* table, const char* str, unsigned int len);
+
+
+// ============================================== line scanning
+
+/// @brief Find every newline in a block of text.
+/// @param data Text to scan
+/// @param len Text length (no more than LOAD_SCAN_BLOCK)
+/// @param out Destination for the offset of each newline
+/// @return Number of newlines found
+typedef size_t (*fptrLineScanner)(const char* data, size_t len, uint32_t* out);
+
+/// @brief Get the fastest newline scanner the CPU supports, falling back to a scalar one.
+/// @return Scanner function
+fptrLineScanner lineScannerGet();
+
+
+// ============================================== huge files
+
+/// @brief Read-only view of a file too large to load into memory. A background
+/// @brief thread builds a sparse index holding the byte offset of every
+/// @brief HUGE_CHECKPOINT_LINES-th line; the page only decodes a window of rows
+/// @brief starting at windowLine. Everything behind the lock is written by the
+/// @brief indexing thread.
+typedef struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	int64_t* checkpoints;
+	int64_t numCheckpoints;
+	int64_t maxCheckpoints;
+	int64_t numLines;
+	int64_t indexedSize;
+	bool done;
+	bool stop;
+	int64_t fileSize;
+	int64_t windowLine;
+	int64_t windowStart;
+	int64_t windowEnd;
+	int fd;
+} hugeFile;
+
+/// @brief Start indexing a huge file in the background.
+/// @param fd File descriptor (owned by the view from now on)
+/// @param size File size
+/// @return Created view (or NULL on error)
+hugeFile* hugeFileOpen(int fd, int64_t size);
+
+/// @brief Stop indexing and free all memory associated with the view.
+/// @param huge View pointer
+void hugeFileClose(hugeFile* huge);
+
+/// @brief Get how much of the file has been indexed so far.
+/// @param huge View pointer
+/// @param lines Destination for the number of lines found (or NULL)
+/// @param percent Destination for the percentage of the file indexed (or NULL)
+/// @return True once the whole file has been indexed
+bool hugeFileProgress(hugeFile* huge, int64_t* lines, int* percent);
+
+/// @brief Find the byte offset of a line, starting from the nearest checkpoint.
+/// @param huge View pointer
+/// @param line Line number (starting at 0)
+/// @param offset Destination for the byte offset
+/// @return True on success, False if the line hasn't been indexed yet
+bool hugeFileFindLine(hugeFile* huge, int64_t line, int64_t* offset);
+
+/// @brief Find the line containing a byte offset, by binary searching the checkpoints.
+/// @param huge View pointer
+/// @param offset Byte offset
+/// @param line Destination for the line number (starting at 0)
+/// @return True on success, False if the offset hasn't been indexed yet
+bool hugeFileFindOffset(hugeFile* huge, int64_t offset, int64_t* line);
+
+
+// ============================================== screen frames
+
+typedef struct editorFrame editorFrame;
+
+/// @brief Screen backend, which shows the lines of a frame that changed on the
+/// @brief terminal. Only getSize is required; a backend without a terminal
+/// @brief just keeps the frame in memory.
+typedef struct {
+	const char* name;
+	bool terminal;																// Draws to the terminal, and reads keys from it.
+	void (*getSize)(editorFrame* frame, int* rows, int* cols);					// Get the size of the screen.
+	void (*begin)(editorFrame* frame);											// Start sending a frame.
+	void (*scrollRegion)(editorFrame* frame, int top, int bottom, int num);		// Scroll part of the screen.
+	void (*line)(editorFrame* frame, int y, const chtype* cells);				// Send a line that changed.
+	int64_t (*end)(editorFrame* frame);											// Place the cursor and return how many bytes were written.
+	void (*release)(editorFrame* frame);										// Free any backend data.
+} frameBackend;
+
+/// @brief Screen contents for one frame, drawn into a grid of cells first.
+/// @brief Each line is hashed when the frame is flushed, and only lines that
+/// @brief changed since the last frame are passed on to the terminal. A frame
+/// @brief can also scroll part of the screen, so lines that only moved don't
+/// @brief need to be sent again.
+typedef struct editorFrame {
+	const frameBackend* backend;
+	void* backendData;
+	chtype* cells;
+	uint64_t* hashes;
+	int rows, cols;
+	int y, x;
+	attr_t attr;
+	int cursorY, cursorX;
+	bool cursorVisible;
+	bool full;
+	int scrollTop, scrollBottom;
+	int scrollNum;
+	bool stats;
+	uint64_t numFrames, numBytes;
+	uint64_t numScrolls, scrollBytes;
+} editorFrame;
+
+/// @brief Initialize a frame structure.
+/// @param frame Frame pointer
+void frameInit(editorFrame* frame);
+
+/// @brief Free all memory associated with the frame.
+/// @param frame Frame pointer
+void frameClear(editorFrame* frame);
+
+/// @brief Find a screen backend by name. "curses" draws through ncurses, while
+/// @brief "vt100" keeps its own copy of the screen and sends each frame to the
+/// @brief terminal with a single write. "headless" never touches the terminal,
+/// @brief and is sized by the LINES and COLUMNS environment variables.
+/// @param name Backend name (or NULL for the default)
+/// @return Backend pointer (or NULL if there is no backend by that name)
+const frameBackend* frameBackendFind(const char* name);
+
+/// @brief Change how frames are sent to the terminal. The next frame is sent in full.
+/// @param frame Frame pointer
+/// @param backend Backend pointer
+void frameSetBackend(editorFrame* frame, const frameBackend* backend);
+
+/// @brief Start drawing a new frame, blanking every cell.
+/// @param frame Frame pointer
+/// @param rows Screen height
+/// @param cols Screen width
+void frameBegin(editorFrame* frame, int rows, int cols);
+
+/// @brief Move the drawing position. Drawing past the end of a line is clipped.
+/// @param frame Frame pointer
+/// @param y Line
+/// @param x Column
+void frameMove(editorFrame* frame, int y, int x);
+
+/// @brief Turn on drawing attributes.
+/// @param frame Frame pointer
+/// @param attr Attributes (A_REVERSE, A_UNDERLINE, etc.)
+void frameAttrOn(editorFrame* frame, attr_t attr);
+
+/// @brief Turn off drawing attributes.
+/// @param frame Frame pointer
+/// @param attr Attributes (A_REVERSE, A_UNDERLINE, etc.)
+void frameAttrOff(editorFrame* frame, attr_t attr);
+
+/// @brief Draw a character. Unprintable characters are drawn as ncurses would.
+/// @param frame Frame pointer
+/// @param c Character
+void frameAddChar(editorFrame* frame, int c);
+
+/// @brief Draw a string, stopping early at a null terminator.
+/// @param frame Frame pointer
+/// @param str String
+/// @param len String length (or -1 to draw until the null terminator)
+void frameAddStr(editorFrame* frame, const char* str, int len);
+
+/// @brief Draw the same character several times.
+/// @param frame Frame pointer
+/// @param c Character
+/// @param num Number of times to draw it
+void frameFill(editorFrame* frame, int c, int num);
+
+/// @brief Set where the cursor is left once the frame is flushed.
+/// @param frame Frame pointer
+/// @param y Line
+/// @param x Column
+/// @param visible Whether to show the cursor
+void frameSetCursor(editorFrame* frame, int y, int x, bool visible);
+
+/// @brief Scroll part of the screen when the frame is flushed, before any
+/// @brief changed lines are sent.
+/// @param frame Frame pointer
+/// @param top First line of the region
+/// @param bottom Last line of the region
+/// @param num Number of lines to scroll up by (or down by if negative)
+void frameScroll(editorFrame* frame, int top, int bottom, int num);
+
+/// @brief Pass the lines that changed since the last frame on to the backend,
+/// @brief and refresh the screen.
+/// @param frame Frame pointer
+void frameFlush(editorFrame* frame);
+
+/// @brief Print how much has been written to the terminal so far. This is
+/// @brief only measured when frame->stats is set.
+/// @param frame Frame pointer
+/// @param fp File pointer
+void framePrintStats(editorFrame* frame, FILE* fp);
+
+
+// ============================================== key input
+
+/// @brief Keys waiting to be handled, which are read before any terminal
+/// @brief input. Headless runs have no terminal, so every key comes from here.
+typedef struct {
+	int* keys;
+	int head, size, capacity;
+} keyQueue;
+
+/// @brief Initialize a key queue structure.
+/// @param queue Queue pointer
+void keyQueueInit(keyQueue* queue);
+
+/// @brief Free all memory associated with the key queue.
+/// @param queue Queue pointer
+void keyQueueClear(keyQueue* queue);
+
+/// @brief Add a key to the back of the queue.
+/// @param queue Queue pointer
+/// @param key Keyboard code
+void keyQueuePush(keyQueue* queue, int key);
+
+/// @brief Add every character of a string to the back of the queue.
+/// @param queue Queue pointer
+/// @param str String
+void keyQueuePushStr(keyQueue* queue, const char* str);
+
+/// @brief Take the key at the front of the queue.
+/// @param queue Queue pointer
+/// @return Keyboard code (or ERR if the queue is empty)
+int keyQueuePop(keyQueue* queue);
+
+
+// ============================================== event loop
+
+/// @brief Function run when a watched file descriptor is ready.
+typedef void (*eventCallback)(void* data, int fd, uint32_t events);
+
+/// @brief File descriptor watched by an event loop.
+typedef struct {
+	int fd;
+	eventCallback callback;
+	void* data;
+} eventSource;
+
+/// @brief File descriptors waited on together through epoll. Input, signals
+/// @brief and timers all arrive as file descriptors, so the editor sleeps in
+/// @brief one place until any of them has something to handle.
+typedef struct {
+	int fd;
+	eventSource* sources;
+	int numSources;
+	int maxSources;
+} eventLoop;
+
+/// @brief Initialize an event loop structure.
+/// @param loop Loop pointer
+/// @return True if the loop was created
+bool eventLoopInit(eventLoop* loop);
+
+/// @brief Free all memory associated with the event loop. Watched file
+/// @brief descriptors are left open for their owners to close.
+/// @param loop Loop pointer
+void eventLoopClear(eventLoop* loop);
+
+/// @brief Start watching a file descriptor for input.
+/// @param loop Loop pointer
+/// @param fd File descriptor
+/// @param callback Function run when fd is ready
+/// @param data Pointer passed to the callback
+/// @return True if the file descriptor is being watched
+bool eventLoopAdd(eventLoop* loop, int fd, eventCallback callback, void* data);
+
+/// @brief Stop watching a file descriptor.
+/// @param loop Loop pointer
+/// @param fd File descriptor
+void eventLoopRemove(eventLoop* loop, int fd);
+
+/// @brief Wait for watched file descriptors to be ready, and run their callbacks.
+/// @param loop Loop pointer
+/// @param delay Milliseconds to wait for (or -1 to wait forever)
+/// @return Number of callbacks run (or -1 on error)
+int eventLoopWait(eventLoop* loop, int delay);
+
+
+// ============================================== background jobs
+
+/// @brief Unit of work for a worker pool. run is called on a worker thread,
+/// @brief then done is called on whichever thread collects finished jobs, and
+/// @brief is responsible for freeing the job. Progress is updated atomically
+/// @brief by run, so it can be shown while the job is going.
+typedef struct workerJob {
+	struct workerJob* next;
+	void (*run)(struct workerJob* job);
+	void (*done)(struct workerJob* job);
+	void* data;
+	uint64_t progress;
+	uint64_t total;
+	bool finished;
+} workerJob;
+
+/// @brief Threads taking jobs off a shared queue. Threads are only started
+/// @brief once there's a job for them, and finished jobs are written to an
+/// @brief eventfd so an event loop can wake up to collect them.
+typedef struct {
+	pthread_t threads[WORKER_MAX_THREADS];
+	int numThreads;
+	int maxThreads;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t finished;
+	workerJob* queue;
+	workerJob* queueTail;
+	workerJob* done;
+	workerJob* doneTail;
+	int numActive;
+	int eventFd;
+	bool stop;
+} workerPool;
+
+/// @brief Initialize a worker pool structure.
+/// @param pool Pool pointer
+/// @param maxThreads Most threads to run at once (or 0 for one per processor)
+/// @return True on success
+bool workerPoolInit(workerPool* pool, int maxThreads);
+
+/// @brief Wait for every job to finish, collect them, then stop the threads
+/// @brief and free all memory associated with the pool.
+/// @param pool Pool pointer
+void workerPoolClear(workerPool* pool);
+
+/// @brief Queue a job to be run on a worker thread.
+/// @param pool Pool pointer
+/// @param job Job pointer
+/// @return True if the job was queued
+bool workerPoolSubmit(workerPool* pool, workerJob* job);
+
+/// @brief Move a job that hasn't started yet to the front of the queue, so it
+/// @brief runs next.
+/// @param pool Pool pointer
+/// @param job Job pointer
+void workerPoolPromote(workerPool* pool, workerJob* job);
+
+/// @brief Block until a job has finished. The job still has to be collected.
+/// @param pool Pool pointer
+/// @param job Job pointer (or NULL to wait for every job)
+void workerPoolWait(workerPool* pool, workerJob* job);
+
+/// @brief Run the done callback of every finished job, in the order they finished.
+/// @param pool Pool pointer
+/// @return Number of jobs collected
+int workerPoolCollect(workerPool* pool);
+
+/// @brief Check if any jobs are queued or running.
+/// @param pool Pool pointer
+/// @return True if the pool has work left
+bool workerPoolIsBusy(workerPool* pool);
+
+/// @brief Update how far along a job is. Called from the job's run function.
+/// @param job Job pointer
+/// @param progress Amount of work done
+/// @param total Total amount of work
+void workerJobSetProgress(workerJob* job, uint64_t progress, uint64_t total);
+
+/// @brief Get how far along a job is.
+/// @param job Job pointer
+/// @return Percentage of the job done
+int workerJobGetPercent(workerJob* job);
+
+
+// ============================================== undo journal
+
+/// @brief Running hash of a file's contents, fed in any number of pieces.
+typedef struct {
+	uint64_t state;
+	uint64_t tail;
+	uint64_t size;
+} contentHash;
+
+/// @brief Single edit to a page: the text inserted at, or deleted from, a
+/// @brief position. Text spanning several rows has a '\n' between each one.
+/// @brief The cursor is kept from before the edit to put it back on undo.
+/// @brief Stored ops have their text in the journal's file instead of memory.
+typedef struct {
+	int kind;
+	int row, col;
+	int cx, cy;
+	size_t offset;
+	size_t len;
+	bool stored;
+} undoOp;
+
+/// @brief History of the edits made to a page. The text of every op is kept
+/// @brief end to end in one buffer, so a run of typing is stored as a single
+/// @brief op, and a large paste costs no more than its own text. Ops before
+/// @brief current can be undone and the rest redone; the oldest ops are dropped
+/// @brief once the journal grows past its limit.
+/// @brief Journals of saved files are also appended to a file next to them,
+/// @brief a batch of ops at a time, and the text of those ops is read back
+/// @brief through a mapping of it instead of being kept in memory. Each save
+/// @brief adds a mark with a hash of what was written, so the history can be
+/// @brief picked up again when the file is next opened, as long as it hasn't
+/// @brief been changed in the meantime.
+typedef struct {
+	undoOp* ops;
+	int firstOp;
+	int current;
+	int numOps;
+	int maxOps;
+	char* text;
+	size_t textStart;
+	size_t textSize;
+	size_t textCapacity;
+	size_t limit;
+	bool merge;
+	char* path;
+	int fd;
+	char* map;
+	size_t mapSize;
+	size_t fileSize;
+	int numStored;
+	int baseOp;
+	int minChanged;
+	bool broken;
+	bool writing;
+} undoJournal;
+
+/// @brief Ops on their way to a journal file, copied out so a save's worker
+/// @brief can write them while the journal carries on being edited. Either
+/// @brief a new file is made at path, or they're added to the open one.
+typedef struct {
+	char* path;
+	int fd;
+	undoOp* ops;
+	int first;
+	int numOps;
+	char* text;
+	size_t textStart;
+	char* map;
+	size_t mapSize;
+	size_t offset;
+	bool failed;
+} undoBatch;
+
+/// @brief Initialize a content hash structure.
+/// @param hash Hash pointer
+void contentHashInit(contentHash* hash);
+
+/// @brief Add the next piece of a file's contents to the hash.
+/// @param hash Hash pointer
+/// @param data Data to hash
+/// @param len Data length
+void contentHashUpdate(contentHash* hash, const void* data, size_t len);
+
+/// @brief Get the hash of everything added so far.
+/// @param hash Hash pointer
+/// @return Hash value
+uint64_t contentHashFinal(contentHash* hash);
+
+/// @brief Initialize an undo journal structure.
+/// @param undo Journal pointer
+/// @param limit Most memory to keep history in (in bytes)
+void undoJournalInit(undoJournal* undo, size_t limit);
+
+/// @brief Free all memory associated with the journal, forgetting every op.
+/// @param undo Journal pointer
+void undoJournalClear(undoJournal* undo);
+
+/// @brief Add an edit to the journal, dropping any ops that were undone. Edits
+/// @brief continuing the last one on the same row, like typing or holding
+/// @brief backspace, are merged into it.
+/// @param undo Journal pointer
+/// @param kind Kind of edit (UK_INSERT or UK_DELETE)
+/// @param row Row the edit starts at
+/// @param col Column the edit starts at
+/// @param text Text inserted or deleted
+/// @param len Text length
+/// @param cx Cursor column before the edit
+/// @param cy Cursor row before the edit
+/// @return True if the edit was recorded
+bool undoJournalRecord(undoJournal* undo, int kind, int row, int col, const char* text, size_t len, int cx, int cy);
+
+/// @brief Stop the next edit from being merged into the last one.
+/// @param undo Journal pointer
+void undoJournalSeal(undoJournal* undo);
+
+/// @brief Step back over the last edit.
+/// @param undo Journal pointer
+/// @return Op to revert (or NULL if there is nothing to undo)
+const undoOp* undoJournalUndo(undoJournal* undo);
+
+/// @brief Step forward over the last undone edit.
+/// @param undo Journal pointer
+/// @return Op to apply again (or NULL if there is nothing to redo)
+const undoOp* undoJournalRedo(undoJournal* undo);
+
+/// @brief Get the text of an op in the journal.
+/// @param undo Journal pointer
+/// @param op Op pointer
+/// @return Text of the op (not null terminated)
+const char* undoJournalText(undoJournal* undo, const undoOp* op);
+
+/// @brief Get how much memory the journal's history is using.
+/// @param undo Journal pointer
+/// @return Size in bytes
+size_t undoJournalSize(undoJournal* undo);
+
+/// @brief Open the journal file of a file that was just loaded, and read
+/// @brief back the history that was saved with it. History saved with some
+/// @brief other version of the file is thrown away.
+/// @param undo Journal pointer (should be empty)
+/// @param path Journal file path
+/// @param hash Hash of the file's contents
+/// @param size Size of the file
+/// @return True if the journal file is open
+bool undoJournalLoad(undoJournal* undo, const char* path, uint64_t hash, uint64_t size);
+
+/// @brief Append every op that's only in memory to the journal file.
+/// @param undo Journal pointer
+/// @return True if the ops were written
+bool undoJournalFlush(undoJournal* undo);
+
+/// @brief Copy out the ops a save's text is made from, so they can be written
+/// @brief to the journal file ahead of the save's mark. Saving under a new
+/// @brief name starts a new file, with the whole history in it.
+/// @param undo Journal pointer
+/// @param path Journal file path
+/// @param batch Batch to fill in, to be run by the save's worker
+/// @return Position to mark once the save is done (or -1 if it can't be)
+int undoJournalCheckpoint(undoJournal* undo, const char* path, undoBatch* batch);
+
+/// @brief Write a batch of ops to its journal file. Safe to call from any thread.
+/// @param batch Batch pointer
+void undoBatchRun(undoBatch* batch);
+
+/// @brief Free all memory associated with a batch, closing any file it still holds.
+/// @param batch Batch pointer
+void undoBatchClear(undoBatch* batch);
+
+/// @brief Read the ops of a batch back from the journal file from now on,
+/// @brief and free the batch. Call before undoJournalMark.
+/// @param undo Journal pointer
+/// @param batch Batch that has been run
+void undoJournalFinish(undoJournal* undo, undoBatch* batch);
+
+/// @brief Mark a finished save in the journal file, unless an edit from
+/// @brief before its checkpoint was undone and replaced since.
+/// @param undo Journal pointer
+/// @param checkpoint Position returned by undoJournalCheckpoint
+/// @param hash Hash of the saved contents
+/// @param size Size of the saved file
+void undoJournalMark(undoJournal* undo, int checkpoint, uint64_t hash, uint64_t size);
+
+
+// ============================================== swap files
+
+/// @brief Swap file of one page, holding the edits made since it was last
+/// @brief saved so they can be replayed after a crash. Records are added to
+/// @brief pending by the editor and written out by the swap writer's thread,
+/// @brief which also frees the file once the page has closed it. The file
+/// @brief is only made once there's an edit to put in it, and removed again
+/// @brief when the page is saved with nothing left unsaved.
+typedef struct swapFile {
+	struct swapFile* next;
+	struct swapWriter* writer;
+	char* path;
+	strbuf pending;
+	strbuf batch;
+	int fd;
+	size_t keep;
+	bool reset;
+	bool closed;
+	bool discard;
+	bool failed;
+	bool started;
+	int index;
+	uint64_t hash;
+	uint64_t size;
+} swapFile;
+
+/// @brief Thread writing every swap file in the background. Once an edit
+/// @brief comes in, the writer waits a moment for more, then writes and syncs
+/// @brief each file with new records, so a burst of typing costs one sync.
+typedef struct swapWriter {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t finished;
+	swapFile* files;
+	swapFile* filesTail;
+	int delay;
+	uint64_t rounds;
+	bool started;
+	bool pending;
+	bool urgent;
+	bool busy;
+	bool stop;
+} swapWriter;
+
+/// @brief Edits found in a swap file left behind by an editor that didn't
+/// @brief shut down cleanly. Ops from first on follow the last save of the
+/// @brief file as it is now, and are replayed onto it in the order written.
+typedef struct {
+	char* path;
+	char* map;
+	size_t mapSize;
+	size_t end;
+	int first;
+	int numOps;
+	int nextIndex;
+	bool locked;
+} swapRecovery;
+
+/// @brief Initialize a swap writer structure. The thread is started once
+/// @brief there's a file to write.
+/// @param writer Writer pointer
+/// @param delay Time to gather edits before writing them (in milliseconds)
+/// @return True on success
+bool swapWriterInit(swapWriter* writer, int delay);
+
+/// @brief Write out everything still pending, then stop the thread and free
+/// @brief every file it still holds.
+/// @param writer Writer pointer
+void swapWriterClear(swapWriter* writer);
+
+/// @brief Create the swap file of a page. Nothing is written until the
+/// @brief page's first edit.
+/// @param writer Writer pointer
+/// @param path Swap file path
+/// @param hash Hash of the file the edits apply to, as last saved
+/// @param size Size of the file, as last saved
+/// @return Swap file pointer (or NULL on failure)
+swapFile* swapFileOpen(swapWriter* writer, const char* path, uint64_t hash, uint64_t size);
+
+/// @brief Let go of a swap file. The writer finishes with it and frees it.
+/// @param swap Swap file pointer
+/// @param discard True to remove the file, false to leave it for recovery
+void swapFileClose(swapFile* swap, bool discard);
+
+/// @brief Queue an edit to be written to the swap file.
+/// @param swap Swap file pointer
+/// @param kind Kind of edit (UK_INSERT or UK_DELETE)
+/// @param row Row the edit starts at
+/// @param col Column the edit starts at
+/// @param text Text inserted or deleted
+/// @param len Text length
+void swapFileRecord(swapFile* swap, int kind, int row, int col, const char* text, size_t len);
+
+/// @brief Get the position to mark once a save that's starting is done.
+/// @param swap Swap file pointer
+/// @return Index of the next edit (or -1 without a swap file)
+int swapFileCheckpoint(swapFile* swap);
+
+/// @brief Mark a finished save, so only the edits made since its checkpoint
+/// @brief are replayed onto the saved file.
+/// @param swap Swap file pointer
+/// @param checkpoint Position returned by swapFileCheckpoint
+/// @param hash Hash of the saved contents
+/// @param size Size of the saved file
+void swapFileMark(swapFile* swap, int checkpoint, uint64_t hash, uint64_t size);
+
+/// @brief Remove the swap file once nothing is left unsaved. The next edit
+/// @brief starts it over.
+/// @param swap Swap file pointer
+/// @param hash Hash of the saved contents
+/// @param size Size of the saved file
+void swapFileReset(swapFile* swap, uint64_t hash, uint64_t size);
+
+/// @brief Carry on writing to a swap file whose edits were just recovered.
+/// @param swap Swap file pointer (with nothing written yet)
+/// @param recovery Recovery the page's edits came from
+void swapFileResume(swapFile* swap, swapRecovery* recovery);
+
+/// @brief Look for edits left in a swap file that can be replayed onto a
+/// @brief file as it is now. Swap files still held by another editor are
+/// @brief left alone, and flagged as locked.
+/// @param recovery Recovery pointer
+/// @param path Swap file path
+/// @param hash Hash of the file's contents
+/// @param size Size of the file
+/// @return True if there are edits to replay
+bool swapRecoveryLoad(swapRecovery* recovery, const char* path, uint64_t hash, uint64_t size);
+
+/// @brief Free all memory associated with the recovery.
+/// @param recovery Recovery pointer
+void swapRecoveryClear(swapRecovery* recovery);
+
 
 // ============================================== editor objects
 
-/// @brief Single row of text.
+/// @brief Tab in a row of text, and the rendered column just past it.
 typedef struct {
+	unsigned int cx;
+	unsigned int rx;
+} rowTab;
+
+/// @brief Single row of text, stored as a list of pieces. A row with at most
+/// @brief one piece keeps it inline and owns no memory besides rtext. Rows
+/// @brief edited in place copy their text into a gap buffer; their pieces are
+/// @brief then the two spans on either side of the gap. The positions of the
+/// @brief row's tabs are indexed on demand to map between cx and rx.
+typedef struct {
+	textPiece* pieces;
+	textPiece piece;
 	strbuf text;
 	strbuf rtext;
+	rowTab* tabs;
+	int numTabs;
+	int maxTabs;
+	bool tabsValid;
+	unsigned int size;
+	unsigned int width;
+	int numPieces;
+	int maxPieces;
 	bool dirty;
 } editorRow;
 
+/// @brief Node in a page's row tree. Leaves hold a block of consecutive rows
+/// @brief and are linked to their neighbours; branches hold child nodes. Every
+/// @brief node tracks how many rows are below it so rows can be found by index,
+/// @brief and the widest of them so the page width is known without a scan.
+/// @brief Nodes are stamped with the epoch they were made in; ones older than
+/// @brief a page's snapshot are shared with it, and copied before being changed.
+typedef struct rowNode {
+	struct rowNode* prev;
+	struct rowNode* next;
+	uint64_t epoch;
+	int numRows;
+	unsigned int maxWidth;
+	int numChildren;
+	bool leaf;
+	union {
+		editorRow rows[ROW_BLOCK_SIZE];
+		struct rowNode* children[ROW_TREE_ORDER];
+	};
+} rowNode;
+
+/// @brief Position of a row within a page's row tree.
+typedef struct {
+	rowNode* leaf;
+	int index;
+} rowIter;
+
 /// @brief Single open file containing many rows of text.
 typedef struct {
-	editorRow* rows;
+	rowNode* rows;
+	pieceTable text;
+	hugeFile* huge;
 	char* filename;
 	char* fullFilename;
-	int maxRows;
-	int numRows, numCols;
+	int numRows;
 	int cx, cy;
 	int rx, ry;
 	int rowOff, colOff;
+	int tabStop;
 	int flags;
+	workerJob* job;
+	uint64_t snapshot;
+	rowNode* retired;
+	undoJournal undo;
+	uint64_t savedHash;
+	uint64_t savedSize;
+	swapFile* swap;
+	swapRecovery* recovery;
 } editorPage;
 
 /// @brief Top level container for open files and editor settings.
@@ -211,7 +1111,7 @@ typedef struct {
 	editorPage* pages;
 	menuGroup* menus;
 	char statusMsg[80];
-	time_t statusMsgTime;
+	int64_t statusMsgTime;
 	int maxPages;
 	int numPages;
 	int currPage;
@@ -219,8 +1119,23 @@ typedef struct {
 	int state;
 	int pageOff;
 	int settingTabStop;
+	int settingInputBudget;
+	bool settingSaveSync;
+	size_t settingUndoLimit;
 	int numMenus;
 	int currMenu;
+	editorFrame frame;
+	keyQueue input;
+	FILE* keyLog;
+	int64_t keyLogStart;
+	eventLoop events;
+	workerPool workers;
+	swapWriter swaps;
+	int signalFd;
+	int timerFd;
+	int64_t timerDeadline;
+	int drawnPage;
+	int64_t drawnLine;
 } editorContext;
 
 /// @brief Initialize a row structure.
@@ -243,6 +1158,32 @@ void rowUpdate(editorContext* ctx, editorRow* row);
 /// @return Rendered X position
 int rowCxToRx(editorContext* ctx, editorRow* row, int cx);
 
+/// @brief Calculate the cursor position for a rendered position. Positions
+/// @brief inside a tab map to the tab itself.
+/// @param ctx Render context pointer
+/// @param row Row pointer
+/// @param rx Rendered X position
+/// @return Cursor X position
+int rowRxToCx(editorContext* ctx, editorRow* row, int rx);
+
+/// @brief Get the list of pieces making up the row's text.
+/// @param row Row pointer
+/// @return Array of row->numPieces pieces
+textPiece* rowGetPieces(editorRow* row);
+
+/// @brief Get a character in the row.
+/// @param row Row pointer
+/// @param at Position (or -1 for last char)
+/// @return Character (or '\0' for invalid position)
+char rowGetChar(editorRow* row, int at);
+
+/// @brief Copy text from the row to the end of a string buffer.
+/// @param row Row pointer
+/// @param buf String buffer pointer
+/// @param at Starting position
+/// @param len Number of characters to copy (or -1 to copy until the end)
+void rowRead(editorRow* row, strbuf* buf, unsigned int at, int len);
+
 /// @brief Insert text into the row.
 /// @param row Row pointer
 /// @param at Position to insert at (or -1 for the end)
@@ -250,6 +1191,16 @@ int rowCxToRx(editorContext* ctx, editorRow* row, int cx);
 /// @param len String length
 void rowInsert(editorRow* row, int at, const char* str, unsigned int len);
 
+/// @brief Insert part of another row's text into the row. Unless either row is
+/// @brief being edited in place, no text is copied and the new pieces share the
+/// @brief source row's buffers.
+/// @param row Row pointer
+/// @param at Position to insert at (or -1 for the end)
+/// @param src Source row pointer
+/// @param srcAt Starting position in the source row
+/// @param len Number of characters to insert (or -1 to insert until the end)
+void rowCopy(editorRow* row, int at, editorRow* src, unsigned int srcAt, int len);
+
 /// @brief Remove text from the row.
 /// @param row Row pointer
 /// @param at Position to delete at
@@ -265,14 +1216,38 @@ void pageInit(editorPage* page);
 /// @param page Page pointer
 void pageClear(editorPage* page);
 
-/// @brief Render all rows of text in the page.
+/// @brief Render the rows of text in view on the page, plus a margin of
+/// @brief NEO_RENDER_MARGIN rows either side. Other rows are rendered when
+/// @brief they are first drawn.
 /// @param ctx Context pointer
 /// @param page Page pointer
 void pageUpdate(editorContext* ctx, editorPage* page);
 
-/// @brief Increase the size of the internal array of rows.
+/// @brief Get a row of text in the page.
 /// @param page Page pointer
-void pageGrowRows(editorPage* page);
+/// @param at Row number
+/// @return Row (or NULL for invalid position)
+editorRow* pageGetRow(editorPage* page, int at);
+
+/// @brief Get a row of text in the page to modify. Rows shared with a snapshot
+/// @brief of the page are copied first, so the snapshot never sees the change.
+/// @param page Page pointer
+/// @param at Row number
+/// @return Row (or NULL for invalid position)
+editorRow* pageEditRow(editorPage* page, int at);
+
+/// @brief Find a row of text in the page and start iterating from it. Any
+/// @brief insertion or deletion of rows invalidates the iterator.
+/// @param page Page pointer
+/// @param at Row number
+/// @param it Iterator pointer
+/// @return Row (or NULL for invalid position)
+editorRow* pageSeekRow(editorPage* page, int at, rowIter* it);
+
+/// @brief Advance a row iterator to the next row in the page.
+/// @param it Iterator pointer
+/// @return Row (or NULL if there are no more rows)
+editorRow* rowIterNext(rowIter* it);
 
 /// @brief Insert a new row of text into the page.
 /// @param page Page pointer
@@ -282,11 +1257,29 @@ void pageGrowRows(editorPage* page);
 /// @return Inserted row
 editorRow* pageInsertRow(editorPage* page, int at, char* str, unsigned int len);
 
+/// @brief Insert a block of text at the cursor, splitting it into rows on newlines.
+/// @param page Page pointer
+/// @param text Text to insert
+/// @param len Text length
+/// @return True if the text was inserted
+bool pageInsertText(editorPage* page, const char* text, unsigned int len);
+
 /// @brief Delete the row of text from the page.
 /// @param page Page poitner
 /// @param at Row to remove
 void pageDeleteRow(editorPage* page, int at);
 
+/// @brief Revert the last edit made to the page, moving the cursor back to
+/// @brief where it was before the edit.
+/// @param page Page pointer
+/// @return True if there was an edit to undo
+bool pageUndo(editorPage* page);
+
+/// @brief Apply the last undone edit to the page again.
+/// @param page Page pointer
+/// @return True if there was an edit to redo
+bool pageRedo(editorPage* page);
+
 /// @brief Move the cursor on the page by a relative amount.
 /// @param ctx Editor context pointer
 /// @param page Page pointer
@@ -304,7 +1297,9 @@ void pageSetCursorRow(editorPage* page, int at);
 /// @param at Column number (or -1 for last character)
 void pageSetCursorCol(editorPage* page, int at);
 
-/// @brief Save the pages contents to file.
+/// @brief Save the pages contents to file. A temporary file is created next to
+/// @brief it straight away, then written from a snapshot of the page on a worker
+/// @brief thread and renamed over the file, so the file is never left half written.
 /// @param ctx Context pointer
 /// @param page Page pointer
 void pageSave(editorContext* ctx, editorPage* page);
@@ -314,6 +1309,53 @@ void pageSave(editorContext* ctx, editorPage* page);
 /// @param filename Full path to file (or NULL to clear)
 void pageSetFullFilename(editorPage* page, char* fullFilename);
 
+/// @brief Load a file into an empty page. The file is split into lines by
+/// @brief several threads at once when it is large enough, each one building
+/// @brief its own run of row blocks, which are then joined in order.
+/// @param ctx Context pointer
+/// @param page Page pointer
+/// @param fp File pointer
+/// @return True on success
+bool pageLoad(editorContext* ctx, editorPage* page, FILE* fp);
+
+/// @brief Decode the window of rows starting at a line of a huge file page.
+/// @param ctx Context pointer
+/// @param page Page pointer
+/// @param line First line of the window (starting at 0)
+/// @return True on success
+bool pageLoadWindow(editorContext* ctx, editorPage* page, int64_t line);
+
+/// @brief Get the render width of the widest row in the page. Rows are
+/// @brief measured when loaded and again whenever they are edited.
+/// @param page Page pointer
+/// @return Number of columns
+int pageGetNumCols(editorPage* page);
+
+/// @brief Get the line number of the first row in the page. This is only
+/// @brief non-zero for huge files, where the rows are a window into the file.
+/// @param page Page pointer
+/// @return Line number (starting at 0)
+int64_t pageGetLineBase(editorPage* page);
+
+/// @brief Get the total number of lines in the page's file.
+/// @param page Page pointer
+/// @return Number of lines (so far, for huge files still being indexed)
+int64_t pageGetLineCount(editorPage* page);
+
+/// @brief Move the cursor to the start of a line.
+/// @param ctx Context pointer
+/// @param page Page pointer
+/// @param line Line number (starting at 0)
+/// @return True on success, False if the line isn't available yet
+bool pageGotoLine(editorContext* ctx, editorPage* page, int64_t line);
+
+/// @brief Move the cursor to the line containing a byte offset in the file.
+/// @param ctx Context pointer
+/// @param page Page pointer
+/// @param offset Byte offset
+/// @return True on success, False if the offset isn't available yet
+bool pageGotoOffset(editorContext* ctx, editorPage* page, int64_t offset);
+
 /// @brief Get whichever number the page is in the tab list.
 /// @param ctx Context pointer
 /// @param page Page pointer
@@ -333,10 +1375,24 @@ void editorClear(editorContext* ctx);
 /// @param ctx Context pointer
 void editorUpdate(editorContext* ctx);
 
+/// @brief Change how the editor is drawn, and resize it to fit the new backend.
+/// @param ctx Context pointer
+/// @param backend Backend pointer
+void editorSetBackend(editorContext* ctx, const frameBackend* backend);
+
 /// @brief Increase the size of the internal array of pages.
 /// @param ctx Context pointer
 void editorGrowPages(editorContext* ctx);
 
+/// @brief Check if any page still has work running in the background.
+/// @param ctx Context pointer
+/// @return True if the screen should be refreshed without waiting for input
+bool editorIsBusy(editorContext* ctx);
+
+/// @brief Wait for every background job to finish, and collect them.
+/// @param ctx Context pointer
+void editorWaitJobs(editorContext* ctx);
+
 /// @brief Get the current state of the editor.
 /// @param ctx Context pointer
 /// @return State
@@ -352,11 +1408,49 @@ void editorPrint(editorContext* ctx);
 /// @param off Horizontal offset
 void editorPrintMenu(editorContext* ctx, menuGroup* grp, int off);
 
+/// @brief Read the next key, from the input queue first and then the terminal.
+/// @brief While waiting, the editor also wakes up for resizes, and when the
+/// @brief status message expires or busy pages need their progress redrawn.
+/// @param ctx Context pointer
+/// @param delay Milliseconds to wait for a key (or -1 to wait forever)
+/// @return Keyboard code (or ERR if there was no key in time, or the screen needs redrawing)
+int editorReadKey(editorContext* ctx, int delay);
+
+/// @brief Watch the terminal's input and the editor's signals from the event
+/// @brief loop. Signals are blocked for the whole process, so this has to be
+/// @brief called before any threads are started.
+/// @param ctx Context pointer
+/// @return True on success
+bool editorWatchTerminal(editorContext* ctx);
+
+/// @brief Start logging every key read from the terminal to a file, along with
+/// @brief when it was read. The log starts with the screen size, then has one
+/// @brief line per key with the microseconds since recording started and the key code.
+/// @param ctx Context pointer
+/// @param filename Log file
+/// @return True on success, False if the file couldn't be opened
+bool editorRecordKeys(editorContext* ctx, const char* filename);
+
+/// @brief Queue up the keys from a log written by editorRecordKeys.
+/// @param ctx Context pointer
+/// @param filename Log file
+/// @param rows Destination for the recorded screen height (unchanged if missing)
+/// @param cols Destination for the recorded screen width (unchanged if missing)
+/// @return True on success, False if the file couldn't be read
+bool editorLoadKeys(editorContext* ctx, const char* filename, int* rows, int* cols);
+
 /// @brief Respond to keyboard input.
 /// @param ctx Context pointer
 /// @param key Keyboard code
 void editorHandleInput(editorContext* ctx, int key);
 
+/// @brief Respond to a key, then to every key already waiting behind it, so a
+/// @brief burst of input like a paste is only drawn once. Gives up after
+/// @brief settingInputBudget milliseconds, so long bursts still get drawn.
+/// @param ctx Context pointer
+/// @param key Keyboard code
+void editorHandleKeys(editorContext* ctx, int key);
+
 /// @brief Open a new page in the editor and make it the current page.
 /// @param ctx Context pointer
 /// @param filename File to open (or NULL for a blank page)
@@ -364,6 +1458,25 @@ void editorHandleInput(editorContext* ctx, int key);
 /// @return Created page (or NULL on error)
 editorPage* editorOpenPage(editorContext* ctx, char* filename, int internal);
 
+/// @brief Open a new page for a file and make it the current page, reading the
+/// @brief file on a worker thread. The page is empty and can't be edited until
+/// @brief the file has been loaded.
+/// @param ctx Context pointer
+/// @param filename File to open
+/// @return Created page (or NULL on error)
+editorPage* editorLoadPage(editorContext* ctx, char* filename);
+
+/// @brief Wait for the page's background job (loading or saving) to finish, and collect it.
+/// @param ctx Context pointer
+/// @param page Page pointer
+void editorWaitPage(editorContext* ctx, editorPage* page);
+
+/// @brief Offer to replay the edits found in a page's swap file, left behind
+/// @brief by an editor that didn't get to save them.
+/// @param ctx Context pointer
+/// @param page Page pointer
+void editorRecoverPage(editorContext* ctx, editorPage* page);
+
 /// @brief Set the currently visible page in the editor.
 /// @param ctx Context pointer
 /// @param at Page number (or -1 for the last page)
@@ -382,6 +1495,12 @@ int editorSetMessage(editorContext* ctx, const char* fmt, ...);
 /// @param save Save the page if it's not a new file
 void editorClosePage(editorContext* ctx, int at, bool save);
 
+/// @brief Save every modified page at once on the worker threads, then ask
+/// @brief whether to retry any that couldn't be saved.
+/// @param ctx Context pointer
+/// @return True if every page was saved
+bool editorSaveAll(editorContext* ctx);
+
 /// @brief Close all pages and exit the program.
 /// @param ctx Context pointer
 /// @return True if pages close, False if cancelled
@@ -420,7 +1539,7 @@ extern const char help_docs_filename[];
 	#define EDITOR_CURR_MENU(ctx) ({ __typeof__ (ctx) _ctx=(ctx); &(_ctx->menus[_ctx->currMenu]); })
 
 	/// @brief Get the row where the cursor is.
-	#define PAGE_CURR_ROW(page) ({ __typeof__ (page) _page=(page); (_page->cy < _page->numRows) ? &(_page->rows[_page->cy]) : NULL; })
+	#define PAGE_CURR_ROW(page) ({ __typeof__ (page) _page=(page); (_page->cy < _page->numRows) ? pageGetRow(_page, _page->cy) : NULL; })
 
 	#define MIN(a,b) ({ __typeof__ (a) _a=(a); __typeof__ (b) _b=(b); _a<_b ? _a : _b; })
 	#define MAX(a,b) ({ __typeof__ (a) _a=(a); __typeof__ (b) _b=(b); _a>_b ? _a : _b; })
@@ -432,7 +1551,7 @@ extern const char help_docs_filename[];
 	#define EDITOR_CURR_MENU(ctx) &((ctx)->menus[(ctx)->currMenu])
 	
 	/// @brief Get the row where the cursor is.
-	#define PAGE_CURR_ROW(page) (((page)->cy < (page)->numRows) ? (&(page)->rows[(page)->cy]) : NULL)
+	#define PAGE_CURR_ROW(page) (((page)->cy < (page)->numRows) ? pageGetRow((page), (page)->cy) : NULL)
 	
 	#define MIN(a, b) ((a) < (b)) ? (a) : (b)
 	#define MAX(a, b) ((a) > (b)) ? (a) : (b)
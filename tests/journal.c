@@ -0,0 +1,118 @@
+/**
+ * journal.c
+ *
+ * Checks that an undo journal saved after undoing most of its history can
+ * be loaded back under a smaller limit, and edited and undone afterwards,
+ * without trimming away the ops that can still be redone, and that edits
+ * made while a save is writing the journal out are kept.
+ */
+#include "../src/neo.h"
+
+#define JOURNAL_OPS 40000
+#define JOURNAL_UNDONE 39000
+#define JOURNAL_SMALL_OPS 100
+
+const char* argp_program_version = "test";
+const char* argp_program_bug_address = "";
+
+static int numFailed = 0;
+
+static void testCheck(bool ok, const char* name) {
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", name);
+	if (!ok) { numFailed++; }
+}
+
+/// @brief Writes out the ops of a journal the way a save does
+static int testCheckpoint(undoJournal* undo, const char* path) {
+	undoBatch batch;
+	int checkpoint = undoJournalCheckpoint(undo, path, &batch);
+	undoBatchRun(&batch);
+	bool written = !batch.failed;
+	undoJournalFinish(undo, &batch);
+	return written ? checkpoint : -1;
+}
+
+/// @brief Fills a journal with single character edits, undoes most of them and saves it
+static bool testSave(const char* path, uint64_t hash, uint64_t size) {
+	undoJournal undo;
+	undoJournalInit(&undo, UNDO_MAX_SIZE);
+	bool saved = (testCheckpoint(&undo, path) >= 0);
+	for(int i=0; i<JOURNAL_OPS && saved; ++i) {
+		saved = undoJournalRecord(&undo, UK_INSERT, i, 0, "x", 1, 0, i);
+		undoJournalSeal(&undo);
+	}
+	for(int i=0; i<JOURNAL_UNDONE && saved; ++i) {
+		saved = (undoJournalUndo(&undo) != NULL);
+	}
+	int checkpoint = saved ? testCheckpoint(&undo, path) : -1;
+	undoJournalMark(&undo, checkpoint, hash, size);
+	undoJournalClear(&undo);
+	return checkpoint >= 0;
+}
+
+/// @brief Replaces an op while a save is writing it out, then saves again
+static void testPending(const char* path) {
+	undoJournal undo;
+	undoJournalInit(&undo, UNDO_MAX_SIZE);
+	testCheckpoint(&undo, path);
+	for(int i=0; i<10; ++i) {
+		undoJournalRecord(&undo, UK_INSERT, i, 0, "x", 1, 0, i);
+		undoJournalSeal(&undo);
+	}
+	undoBatch batch;
+	int checkpoint = undoJournalCheckpoint(&undo, path, &batch);
+	undoJournalUndo(&undo);
+	undoJournalUndo(&undo);
+	undoJournalRecord(&undo, UK_INSERT, 8, 0, "y", 1, 0, 8);
+	undoBatchRun(&batch);
+	undoJournalFinish(&undo, &batch);
+	undoJournalMark(&undo, checkpoint, 1, 10);
+	undoJournalMark(&undo, testCheckpoint(&undo, path), 2, 9);
+	undoJournalClear(&undo);
+
+	// Only the second save can be matched up with the file
+	undoJournalInit(&undo, UNDO_MAX_SIZE);
+	testCheck(!undoJournalLoad(&undo, path, 1, 10), "save with a replaced op not marked");
+	testCheck(undoJournalLoad(&undo, path, 2, 9), "save after it marked");
+	const undoOp* op = undoJournalUndo(&undo);
+	testCheck(undo.numOps == 9 && op && memcmp(undoJournalText(&undo, op), "y", 1) == 0, "op replaced while saving read back");
+	undoJournalClear(&undo);
+}
+
+int main() {
+	char dir[] = "/tmp/neo-journal-XXXXXX";
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	char path[256];
+	snprintf(path, sizeof(path), "%s/.f.txt.undo", dir);
+	uint64_t hash = 0x1234;
+	uint64_t size = 42;
+	testCheck(testSave(path, hash, size), "journal saved after undoing");
+
+	// Load it back with room for only a few ops
+	undoJournal undo;
+	undoJournalInit(&undo, JOURNAL_SMALL_OPS * sizeof(undoOp));
+	testCheck(undoJournalLoad(&undo, path, hash, size), "journal loaded under a smaller limit");
+	int numUndone = JOURNAL_OPS - JOURNAL_UNDONE;
+	testCheck(undo.firstOp <= undo.current && undo.current <= undo.numOps, "position kept inside the history");
+	testCheck(undo.numOps - undo.current == JOURNAL_UNDONE, "undone ops can still be redone");
+
+	// A new edit replaces the undone ops
+	testCheck(undoJournalRecord(&undo, UK_INSERT, 0, 0, "y", 1, 0, 0), "edit after loading");
+	testCheck(undo.firstOp <= undo.current && undo.current == undo.numOps, "edit added at the current position");
+	int numUndos = 0;
+	for(const undoOp* op = undoJournalUndo(&undo); op; op = undoJournalUndo(&undo)) {
+		numUndos++;
+	}
+	testCheck(numUndos >= 1 && numUndos <= numUndone + 1, "edits undone back to the start of the history");
+	undoJournalClear(&undo);
+	unlink(path);
+	testPending(path);
+
+	// Clean up
+	unlink(path);
+	rmdir(dir);
+	return (numFailed > 0) ? 1 : 0;
+}
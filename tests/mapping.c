@@ -0,0 +1,82 @@
+/**
+ * mapping.c
+ *
+ * Checks that a file mapped into a piece table can be truncated or written
+ * over by another program without crashing the editor, and that the change
+ * is noticed so the text can be copied out before it's saved.
+ */
+#include "../src/neo.h"
+
+#define MAPPING_SIZE (256 * 1024)
+
+const char* argp_program_version = "test";
+const char* argp_program_bug_address = "";
+
+static int numFailed = 0;
+
+static void testCheck(bool ok, const char* name) {
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", name);
+	if (!ok) { numFailed++; }
+}
+
+/// @brief Writes a file big enough to be mapped, filled with one character
+static bool testWrite(const char* path, char c) {
+	FILE* fp = fopen(path, "w");
+	if (!fp) { return false; }
+	for(int i=0; i<MAPPING_SIZE; ++i) {
+		fputc((i % 64 == 63) ? '\n' : c, fp);
+	}
+	return fclose(fp) == 0;
+}
+
+static bool testLoad(pieceTable* table, const char* path) {
+	pieceTableInit(table);
+	FILE* fp = fopen(path, "r");
+	if (!fp) { return false; }
+	bool loaded = pieceTableLoad(table, fp);
+	fclose(fp);
+	return loaded && table->mapped;
+}
+
+/// @brief Moves the file's modification time on, as a later write would
+static void testTouch(const char* path, pieceTable* table) {
+	struct timespec times[2] = { table->mtime, table->mtime };
+	times[1].tv_sec++;
+	utimensat(AT_FDCWD, path, times, 0);
+}
+
+int main() {
+	char dir[] = "/tmp/neo-mapping-XXXXXX";
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	char path[256];
+	snprintf(path, sizeof(path), "%s/f.txt", dir);
+
+	// Truncated files read back as zeros past their new end
+	pieceTable table;
+	testCheck(testWrite(path, 'a') && testLoad(&table, path), "file mapped");
+	testCheck(!pieceTableChanged(&table), "file unchanged after loading");
+	testCheck(truncate(path, 0) == 0 && pieceTableChanged(&table), "truncated file noticed");
+	testCheck(table.original[MAPPING_SIZE - 2] == '\0', "truncated text read without crashing");
+	testCheck(pieceTableDetach(&table) && !pieceTableChanged(&table), "truncated file detached");
+	pieceTableClear(&table);
+
+	// Files written over in place are noticed by their modification time
+	testCheck(testWrite(path, 'a') && testLoad(&table, path), "file mapped again");
+	int fd = open(path, O_WRONLY);
+	testCheck(fd >= 0 && pwrite(fd, "b", 1, 0) == 1, "file written over in place");
+	if (fd >= 0) { close(fd); }
+	testTouch(path, &table);
+	testCheck(pieceTableChanged(&table), "file written over noticed");
+	testCheck(pieceTableDetach(&table), "file written over detached");
+	testWrite(path, 'c');
+	testCheck(table.original[0] == 'b' && table.original[1] == 'a', "detached text kept");
+	pieceTableClear(&table);
+
+	// Clean up
+	unlink(path);
+	rmdir(dir);
+	return (numFailed > 0) ? 1 : 0;
+}
@@ -0,0 +1,197 @@
+/**
+ * signals.c
+ *
+ * Checks that the editor still exits when it is told to close, or loses
+ * its terminal, while a prompt is waiting for an answer, and that the
+ * swap file of a modified page is left behind for recovery.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define EDITOR_BINARY "./bin/neo"
+#define EXIT_TIMEOUT 3000
+#define SWAP_WAIT 600
+
+typedef struct editorProcess {
+	pid_t pid;
+	int fd;
+	char screen[65536];
+	size_t size;
+} editorProcess;
+
+static char dir[] = "/tmp/neo-signals-XXXXXX";
+static char filename[256];
+static char swapname[256];
+
+static int64_t testClock() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t)(ts.tv_sec) * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/// @brief Collects what the editor draws for a while
+static void testDrain(editorProcess* proc, int ms) {
+	int64_t deadline = testClock() + ms;
+	for(int64_t now = testClock(); now < deadline; now = testClock()) {
+		struct pollfd pfd = { .fd = proc->fd, .events = POLLIN };
+		if (poll(&pfd, 1, (int)(deadline - now)) <= 0) { continue; }
+		char buf[4096];
+		ssize_t len = read(proc->fd, buf, sizeof(buf));
+		if (len <= 0) { return; }
+
+		// Only the most recent output matters
+		if (proc->size + len >= sizeof(proc->screen)) {
+			proc->size = 0;
+		}
+		memcpy(&proc->screen[proc->size], buf, len);
+		proc->size += len;
+		proc->screen[proc->size] = '\0';
+	}
+}
+
+/// @brief Waits for some text to be drawn
+static bool testWaitFor(editorProcess* proc, const char* text, int ms) {
+	int64_t deadline = testClock() + ms;
+	while(testClock() < deadline) {
+		if (memmem(proc->screen, proc->size, text, strlen(text))) { return true; }
+		testDrain(proc, 50);
+	}
+	return false;
+}
+
+static bool testStart(editorProcess* proc) {
+	memset(proc, 0, sizeof(*proc));
+	struct winsize size = { .ws_row = 24, .ws_col = 80 };
+	proc->pid = forkpty(&proc->fd, NULL, NULL, &size);
+	if (proc->pid < 0) { return false; }
+	if (proc->pid == 0) {
+		setenv("TERM", "xterm", 1);
+		execl(EDITOR_BINARY, EDITOR_BINARY, filename, (char*)(NULL));
+		_exit(127);
+	}
+	testDrain(proc, 300);
+	return true;
+}
+
+static void testKeys(editorProcess* proc, const char* keys) {
+	if (write(proc->fd, keys, strlen(keys)) < 0) { return; }
+	testDrain(proc, 100);
+}
+
+/// @brief Waits for the editor to exit, killing it if it doesn't
+static bool testExited(editorProcess* proc) {
+	int64_t deadline = testClock() + EXIT_TIMEOUT;
+	bool exited = false;
+	while(!exited && testClock() < deadline) {
+		exited = (waitpid(proc->pid, NULL, WNOHANG) == proc->pid);
+		if (!exited) { usleep(20000); }
+	}
+	if (!exited) {
+		kill(proc->pid, SIGKILL);
+		waitpid(proc->pid, NULL, 0);
+	}
+	if (proc->fd >= 0) {
+		close(proc->fd);
+		proc->fd = -1;
+	}
+	return exited;
+}
+
+static void testReset() {
+	unlink(swapname);
+	FILE* fp = fopen(filename, "w");
+	if (fp) {
+		fputs("abc\n", fp);
+		fclose(fp);
+	}
+}
+
+/// @brief Leaves an unsaved edit behind in the swap file
+static bool testCrash() {
+	editorProcess proc;
+	if (!testStart(&proc)) { return false; }
+	testKeys(&proc, "x");
+	testDrain(&proc, SWAP_WAIT);
+	kill(proc.pid, SIGKILL);
+	testExited(&proc);
+	return access(swapname, F_OK) == 0;
+}
+
+/// @brief Opens a prompt with keys, or waits for one to appear, then signals the editor
+static bool testPrompt(const char* keys, const char* prompt, int sig, bool hangup) {
+	editorProcess proc;
+	if (!testStart(&proc)) { return false; }
+	if (keys) {
+		testKeys(&proc, keys);
+	}
+	if (!testWaitFor(&proc, prompt, 2000)) {
+		kill(proc.pid, SIGKILL);
+		testExited(&proc);
+		return false;
+	}
+	if (sig) {
+		kill(proc.pid, sig);
+	}
+	if (hangup) {
+		close(proc.fd);
+		proc.fd = -1;
+	}
+	return testExited(&proc);
+}
+
+static int numFailed = 0;
+
+static void testCheck(bool ok, const char* name) {
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", name);
+	if (!ok) { numFailed++; }
+}
+
+int main() {
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	snprintf(filename, sizeof(filename), "%s/f.txt", dir);
+	snprintf(swapname, sizeof(swapname), "%s/.f.txt.swp", dir);
+
+	// The recovery prompt shows up by itself when the editor starts
+	testReset();
+	testCheck(testCrash(), "swap file left by a crash");
+	testCheck(testPrompt(NULL, "unsaved edit", SIGHUP, false), "SIGHUP at the recovery prompt");
+	testCheck(access(swapname, F_OK) == 0, "swap file kept after SIGHUP");
+	testCheck(testPrompt(NULL, "unsaved edit", SIGTERM, false), "SIGTERM at the recovery prompt");
+	testCheck(testPrompt(NULL, "unsaved edit", 0, true), "terminal closed at the recovery prompt");
+	testCheck(access(swapname, F_OK) == 0, "swap file kept after the terminal closed");
+
+	// Then the others, on a modified page
+	testReset();
+	testCheck(testPrompt("x\x0f", "Open file", SIGHUP, false), "SIGHUP at the open prompt");
+	testCheck(access(swapname, F_OK) == 0, "swap file kept for the modified page");
+	testReset();
+	testCheck(testPrompt("x\x11", "Save all files?", SIGHUP, false), "SIGHUP at the save prompt");
+	testReset();
+	testCheck(testPrompt("x\x07", "Go to line", SIGTERM, false), "SIGTERM at the go to line prompt");
+	testReset();
+	testCheck(testPrompt("x\x0f", "Open file", 0, true), "terminal closed at the open prompt");
+
+	// Clean up
+	unlink(swapname);
+	unlink(filename);
+	char undoname[256];
+	snprintf(undoname, sizeof(undoname), "%s/.f.txt.undo", dir);
+	unlink(undoname);
+	rmdir(dir);
+	return (numFailed > 0) ? 1 : 0;
+}